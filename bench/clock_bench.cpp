@@ -0,0 +1,80 @@
+#include "kernels.hpp"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/*
+** Microbenchmark for the vector clock kernels. Reports ns per join and per
+** <= comparison for every kernel set the CPU supports, and the speedup over
+** the scalar kernels.
+*/
+
+const uint32_t NUM_ROWS = 4096; // rows per width, sized to stay in L2
+const uint32_t NUM_OPS = 1 << 22;
+
+struct Result {
+  double join_ns;
+  double leq_ns;
+};
+
+static Result run(const ClockKernels &k, uint32_t width) {
+  std::mt19937 rng{42};
+  std::vector<uint32_t> rows(static_cast<size_t>(NUM_ROWS) * width);
+  for (auto &ts : rows)
+    ts = rng() % 1024;
+
+  std::vector<uint32_t> pairs(NUM_OPS * 2);
+  for (auto &row : pairs)
+    row = rng() % NUM_ROWS;
+
+  std::vector<uint32_t> acc(width, 0);
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < NUM_OPS; ++i)
+    k.join(acc.data(), rows.data() + static_cast<size_t>(pairs[i]) * width,
+           width);
+  auto join = std::chrono::steady_clock::now() - start;
+
+  // Compare each row against the join of all rows, so every comparison
+  // scans the full width
+  uint64_t ordered = 0;
+  start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < NUM_OPS; ++i)
+    ordered += k.lessOrEqual(
+        rows.data() + static_cast<size_t>(pairs[i]) * width, acc.data(),
+        width);
+  auto leq = std::chrono::steady_clock::now() - start;
+
+  if (ordered != NUM_OPS)
+    std::cerr << "unexpected comparison result for " << k.name << std::endl;
+
+  return {std::chrono::duration<double, std::nano>(join).count() / NUM_OPS,
+          std::chrono::duration<double, std::nano>(leq).count() / NUM_OPS};
+}
+
+auto main() -> int {
+  std::vector<const ClockKernels *> kernels = availableClockKernels();
+  std::cout << "Selected kernels: " << clockKernels().name << std::endl
+            << std::endl;
+
+  std::cout << std::setw(8) << "threads" << std::setw(9) << "kernels"
+            << std::setw(13) << "join (ns)" << std::setw(13) << "speedup"
+            << std::setw(13) << "<= (ns)" << std::setw(13) << "speedup"
+            << std::endl
+            << std::fixed << std::setprecision(2);
+
+  for (uint32_t width : {8, 64, 256}) {
+    Result scalar = run(*kernels.front(), width);
+    for (auto k : kernels) {
+      Result r = k == kernels.front() ? scalar : run(*k, width);
+      std::cout << std::setw(8) << width << std::setw(9) << k->name
+                << std::setw(13) << r.join_ns << std::setw(13)
+                << scalar.join_ns / r.join_ns << std::setw(13) << r.leq_ns
+                << std::setw(13) << scalar.leq_ns / r.leq_ns << std::endl;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "closure.hpp"
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+/*
+** Benchmark for building Closure with dense and sparse clocks. Generates
+** traces in which reads follow sole writers, and reports the build time for
+** either storage at 64, 128 and 256 threads.
+*/
+
+const uint32_t NUM_EVENTS = 1 << 16; // events per trace, over all threads
+const uint32_t NUM_RUNS = 3;         // builds per storage, the fastest counts
+const uint32_t GROUP_SIZE = 8;       // threads that mostly talk to each other
+
+struct Workload {
+  std::vector<Event> trace;
+  std::vector<std::vector<Event>> events;
+  std::vector<std::pair<EventId, EventId>> relations; // (read, sole writer)
+};
+
+/* Every third event writes a fresh value, every third reads one. Threads
+ * work in groups of GROUP_SIZE and read from their own group, or from any
+ * thread with probability remote, so joins change few entries unless remote
+ * is high. */
+static Workload generate(uint32_t numThreads, double remote) {
+  std::mt19937 rng{42};
+  std::uniform_int_distribution<uint32_t> anyThread{0, numThreads - 1};
+  std::uniform_int_distribution<uint32_t> groupMember{0, GROUP_SIZE - 1};
+  std::bernoulli_distribution isRemote{remote};
+
+  Workload w;
+  w.events.resize(numThreads);
+  std::vector<std::vector<EventId>> writes(numThreads);
+
+  for (uint32_t i = 0; i < NUM_EVENTS; ++i) {
+    tid_t tid = anyThread(rng);
+    EventId id{tid, static_cast<eid_t>(w.events[tid].size())};
+
+    EventType type = EventType::Write;
+    if (i % 3 == 1) {
+      tid_t from = isRemote(rng)
+                       ? anyThread(rng)
+                       : tid - tid % GROUP_SIZE + groupMember(rng);
+      if (!writes[from].empty()) {
+        type = EventType::Read;
+        w.relations.push_back({id, writes[from].back()});
+      }
+    } else if (i % 3 == 0) {
+      writes[tid].push_back(id);
+    }
+
+    Event e{Event::createRawEvent(type, tid, 0, i), i};
+    w.trace.push_back(e);
+    w.events[tid].push_back(e);
+  }
+
+  return w;
+}
+
+/* Returns the fastest of NUM_RUNS builds in ms */
+static double run(Workload &w, uint32_t numThreads, bool sparse) {
+  double best = 0;
+  for (uint32_t i = 0; i < NUM_RUNS; ++i) {
+    Closure::Builder cb{numThreads, sparse};
+    for (const auto &[read, write] : w.relations)
+      cb.addRelation(read, write);
+
+    auto start = std::chrono::steady_clock::now();
+    Closure clj = cb.build(w.trace, w.events);
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+    if (i == 0 || ms < best)
+      best = ms;
+  }
+
+  return best;
+}
+
+auto main() -> int {
+  std::cout << std::setw(8) << "threads" << std::setw(11) << "remote %"
+            << std::setw(13) << "dense (ms)" << std::setw(13) << "sparse (ms)"
+            << std::setw(13) << "speedup" << std::endl
+            << std::fixed << std::setprecision(2);
+
+  for (uint32_t numThreads : {64, 128, 256})
+    for (double remote : {0.001, 0.01, 0.1, 1.0}) {
+      Workload w = generate(numThreads, remote);
+      double dense = run(w, numThreads, false);
+      double sparse = run(w, numThreads, true);
+      std::cout << std::setw(8) << numThreads << std::setw(11) << remote * 100
+                << std::setw(13) << dense << std::setw(13) << sparse
+                << std::setw(13) << dense / sparse << std::endl;
+    }
+
+  return 0;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+** Memory of the nodes of a search and of the persistent state they share
+*/
+
+/* Bump allocator owned by a single thread. Freed blocks are recycled by size.
+ * Blocks freed by other threads, e.g. helpers of a parallel search, are pushed
+ * onto a lock-free remote list that the owner moves to its free lists when it
+ * next allocates. Allocations above MAX_SIZE bytes bypass the arena. */
+class NodeArena {
+private:
+  static const size_t BLOCK_SIZE = 1 << 20;
+  static const size_t GRAIN = 16;
+  static const size_t MAX_SIZE = 1024;
+
+  std::thread::id owner;
+  std::vector<std::unique_ptr<std::byte[]>> blocks;
+  std::byte *cursor = nullptr;
+  std::byte *end = nullptr;
+  std::array<void *, MAX_SIZE / GRAIN> freeLists{}; // by size in grains - 1
+
+  /* Block freed by another thread, in place of its memory */
+  struct Remote {
+    Remote *next;
+    size_t bytes;
+  };
+  static_assert(sizeof(Remote) <= GRAIN);
+
+  std::atomic<Remote *> remote{nullptr};
+
+  static inline thread_local NodeArena *active = nullptr;
+
+  static size_t roundUp(size_t bytes) {
+    return bytes == 0 ? GRAIN : (bytes + GRAIN - 1) & ~(GRAIN - 1);
+  }
+
+  void pushFree(void *p, size_t bytes) {
+    void *&head = freeLists[bytes / GRAIN - 1];
+    *static_cast<void **>(p) = head;
+    head = p;
+  }
+
+  /* Moves the blocks freed by other threads to the free lists */
+  void drainRemote() {
+    Remote *r = remote.exchange(nullptr, std::memory_order_acquire);
+    while (r != nullptr) {
+      Remote *next = r->next;
+      pushFree(r, r->bytes);
+      r = next;
+    }
+  }
+
+public:
+  static const size_t ALIGNMENT = GRAIN;
+
+  NodeArena() : owner{std::this_thread::get_id()} {}
+
+  NodeArena(const NodeArena &) = delete;
+  NodeArena &operator=(const NodeArena &) = delete;
+
+  /* Arena that nodes created by the calling thread are allocated from, if
+   * any */
+  static NodeArena *current() { return active; }
+
+  /* Arena of the calling thread for its sequential searches */
+  static NodeArena &local() {
+    static thread_local NodeArena arena;
+    return arena;
+  }
+
+  /* Makes an arena current for the calling thread while in scope. If reset,
+   * the arena is reset when the scope ends, so every node allocated in the
+   * scope must be gone by then. */
+  class Scope {
+  private:
+    NodeArena &arena;
+    NodeArena *prev;
+    bool reset;
+
+  public:
+    explicit Scope(NodeArena &arena_, bool reset_ = false)
+        : arena{arena_}, prev{active}, reset{reset_} {
+      active = &arena;
+    }
+
+    ~Scope() {
+      active = prev;
+      if (reset)
+        arena.reset();
+    }
+
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+  };
+
+  void *allocate(size_t bytes) {
+    bytes = roundUp(bytes);
+    if (bytes > MAX_SIZE)
+      return ::operator new(bytes);
+
+    if (remote.load(std::memory_order_relaxed) != nullptr)
+      drainRemote();
+
+    void *&head = freeLists[bytes / GRAIN - 1];
+    if (head != nullptr) {
+      void *p = head;
+      head = *static_cast<void **>(p);
+      return p;
+    }
+
+    if (static_cast<size_t>(end - cursor) < bytes) {
+      blocks.emplace_back(new std::byte[BLOCK_SIZE]);
+      cursor = blocks.back().get();
+      end = cursor + BLOCK_SIZE;
+    }
+
+    void *p = cursor;
+    cursor += bytes;
+    return p;
+  }
+
+  void deallocate(void *p, size_t bytes) {
+    bytes = roundUp(bytes);
+    if (bytes > MAX_SIZE) {
+      ::operator delete(p);
+      return;
+    }
+
+    if (std::this_thread::get_id() != owner) {
+      Remote *r = new (p) Remote{remote.load(std::memory_order_relaxed), bytes};
+      while (!remote.compare_exchange_weak(r->next, r,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+        ;
+      return;
+    }
+
+    pushFree(p, bytes);
+  }
+
+  /* Frees everything allocated at once, keeping a block for reuse */
+  void reset() {
+    if (blocks.size() > 1)
+      blocks.resize(1);
+    cursor = blocks.empty() ? nullptr : blocks.front().get();
+    end = blocks.empty() ? nullptr : cursor + BLOCK_SIZE;
+    freeLists.fill(nullptr);
+    remote.store(nullptr, std::memory_order_relaxed);
+  }
+};
+
+/* Allocates from the arena that was current when it was made, or from the
+ * heap if there was none */
+template <typename T> class ArenaAllocator {
+private:
+  template <typename U> friend class ArenaAllocator;
+
+  NodeArena *arena;
+
+public:
+  typedef T value_type;
+
+  typedef std::true_type propagate_on_container_move_assignment;
+
+  ArenaAllocator() : arena{NodeArena::current()} {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena{other.arena} {}
+
+  /* Copies of a container allocate from the arena of the copying thread */
+  ArenaAllocator select_on_container_copy_construction() const { return {}; }
+
+  T *allocate(size_t n) {
+    static_assert(alignof(T) <= NodeArena::ALIGNMENT);
+    if (arena == nullptr)
+      return std::allocator<T>{}.allocate(n);
+    return static_cast<T *>(arena->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T *p, size_t n) {
+    if (arena == nullptr)
+      std::allocator<T>{}.deallocate(p, n);
+    else
+      arena->deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U> bool operator==(const ArenaAllocator<U> &other) const {
+    return arena == other.arena;
+  }
+};
+
+/* make_shared from the current arena */
+template <typename T, typename... Args>
+std::shared_ptr<T> makeNode(Args &&...args) {
+  return std::allocate_shared<T>(ArenaAllocator<T>{},
+                                 std::forward<Args>(args)...);
+}
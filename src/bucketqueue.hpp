@@ -0,0 +1,129 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/*
+** Priority queue for the small integer keys of search nodes
+*/
+
+/* Min-priority queue of values with integer keys up to a bound set by reset.
+ * Keys are spread over NUM_BUCKETS buckets by shifting them right just enough
+ * for the bound to fit. If no shift is needed, each key has a bucket of its
+ * own, kept in push order, so pushing and popping costs O(1) amortized.
+ * Otherwise each bucket is a binary heap of the keys it covers, e.g. one per
+ * depth for keys with the depth in their high bits. Values with equal keys
+ * are popped in the order they were pushed. Keys above the bound share the
+ * last bucket, which is always a heap, so they are still popped in order. */
+template <typename T, size_t NUM_BUCKETS = 1 << 16> class BucketQueue {
+private:
+  /* Popped values are only erased from a bucket once they make up most of
+   * it, or it is empty */
+  static const size_t COMPACT_SIZE = 64;
+
+  struct Entry {
+    uint64_t key;
+    uint64_t seq;
+    T value;
+  };
+
+  struct EntryCmp {
+    bool operator()(const Entry &a, const Entry &b) const {
+      return a.key != b.key ? a.key > b.key : a.seq > b.seq;
+    }
+  };
+
+  struct Bucket {
+    std::vector<Entry> entries; // a heap if the bucket is ordered
+    size_t head = 0; // entries before head have been popped, 0 in heaps
+  };
+
+  std::vector<Bucket> buckets; // grows up to the largest bucket pushed to
+  unsigned shift = 0;          // keys >> shift is their bucket
+  size_t cursor = 0;           // no bucket before cursor holds values
+  size_t count = 0;            // number of values held
+  uint64_t seq = 0;            // pushes so far
+
+  size_t bucketOf(uint64_t key) const {
+    return std::min<uint64_t>(key >> shift, NUM_BUCKETS - 1);
+  }
+
+  /* Returns if bucket b holds several keys, and so is a heap */
+  bool isOrdered(size_t b) const { return shift > 0 || b == NUM_BUCKETS - 1; }
+
+public:
+  bool empty() const { return count == 0; }
+  size_t size() const { return count; }
+
+  /* Value with the lowest key, the earliest pushed among them */
+  const T &top() const {
+    const Bucket &b = buckets[cursor];
+    return b.entries[b.head].value;
+  }
+
+  uint64_t topKey() const {
+    const Bucket &b = buckets[cursor];
+    return b.entries[b.head].key;
+  }
+
+  void push(uint64_t key, T value) {
+    size_t k = bucketOf(key);
+    if (k >= buckets.size())
+      buckets.resize(k + 1);
+
+    Bucket &b = buckets[k];
+    b.entries.push_back({key, seq++, std::move(value)});
+    if (isOrdered(k))
+      std::push_heap(b.entries.begin(), b.entries.end(), EntryCmp{});
+
+    if (count == 0 || k < cursor)
+      cursor = k;
+    ++count;
+  }
+
+  /* Drops every value, keeping the capacity of the buckets */
+  void clear() {
+    for (size_t k = cursor; count != 0 && k < buckets.size(); ++k) {
+      count -= buckets[k].entries.size() - buckets[k].head;
+      buckets[k].entries.clear();
+      buckets[k].head = 0;
+    }
+
+    cursor = 0;
+    count = 0;
+    seq = 0;
+  }
+
+  /* Drops every value, and spreads keys up to maxKey over the buckets */
+  void reset(uint64_t maxKey) {
+    clear();
+    for (shift = 0; (maxKey >> shift) >= NUM_BUCKETS; ++shift)
+      ;
+  }
+
+  void pop() {
+    Bucket &b = buckets[cursor];
+    --count;
+
+    if (isOrdered(cursor)) {
+      std::pop_heap(b.entries.begin(), b.entries.end(), EntryCmp{});
+      b.entries.pop_back();
+    } else {
+      b.entries[b.head++].value = T{};
+      if (b.head == b.entries.size()) {
+        b.entries.clear();
+        b.head = 0;
+      } else if (b.head >= COMPACT_SIZE && 2 * b.head >= b.entries.size()) {
+        b.entries.erase(b.entries.begin(), b.entries.begin() + b.head);
+        b.head = 0;
+      }
+    }
+
+    // Keep the capacity of emptied buckets, they are likely to be refilled
+    while (count != 0 && buckets[cursor].entries.empty())
+      ++cursor;
+  }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+/* Limits on the search for a single COP, 0 means no limit */
+struct SearchBudget {
+  uint64_t nodes = 0; // nodes explored
+  double seconds = 0; // wall time
+  size_t bytes = 0;   // estimated size of the visited set and frontier
+
+  bool isLimited() const { return nodes != 0 || seconds != 0 || bytes != 0; }
+
+  /* Returns the budget with every limit multiplied by factor */
+  SearchBudget scaled(double factor) const {
+    return {static_cast<uint64_t>(nodes * factor), seconds * factor,
+            static_cast<size_t>(bytes * factor)};
+  }
+};
+
+/* Charges the work of a single search against its budget. Shared by all
+ * threads working on the search. */
+class BudgetMeter {
+private:
+  /* Wall time is only looked at every CLOCK_INTERVAL nodes */
+  static const uint64_t CLOCK_INTERVAL = 256;
+
+  SearchBudget budget;
+  std::chrono::steady_clock::time_point start;
+  std::atomic<size_t> bytes{0};
+  std::atomic<bool> cancelled{false};
+
+public:
+  explicit BudgetMeter(const SearchBudget &budget_)
+      : budget{budget_}, start{std::chrono::steady_clock::now()} {}
+
+  BudgetMeter(const BudgetMeter &) = delete;
+  BudgetMeter &operator=(const BudgetMeter &) = delete;
+
+  /* Records n more bytes held by the search */
+  void charge(size_t n) {
+    if (budget.bytes != 0)
+      bytes.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  /* Records n bytes no longer held by the search. Estimates of the same
+   * node may differ over time, so this never drops below zero. */
+  void release(size_t n) {
+    if (budget.bytes == 0)
+      return;
+
+    size_t held = bytes.load(std::memory_order_relaxed);
+    while (!bytes.compare_exchange_weak(held, held > n ? held - n : 0,
+                                        std::memory_order_relaxed))
+      ;
+  }
+
+  /* Makes the search stop as if out of budget, e.g. once another search has
+   * decided its COP */
+  void cancel() { cancelled.store(true, std::memory_order_relaxed); }
+
+  /* Returns if a search that has explored nodes is out of budget */
+  bool exceeded(uint64_t nodes) const {
+    if (cancelled.load(std::memory_order_relaxed))
+      return true;
+
+    if (budget.nodes != 0 && nodes >= budget.nodes)
+      return true;
+
+    if (budget.bytes != 0 &&
+        bytes.load(std::memory_order_relaxed) >= budget.bytes)
+      return true;
+
+    if (budget.seconds != 0 && nodes % CLOCK_INTERVAL == 0)
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start)
+                 .count() >= budget.seconds;
+
+    return false;
+  }
+};
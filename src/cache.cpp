@@ -0,0 +1,246 @@
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+
+#include "cache.hpp"
+#include "errors.hpp"
+#include "mapped.hpp"
+#include "serialize.hpp"
+
+typedef std::unordered_map<vid_t,
+                           std::unordered_map<uint32_t, std::vector<EventId>>>
+    AccessMap;
+
+static inline uint64_t rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix(uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+std::optional<uint64_t> hashFile(const std::string &filename) {
+  MappedFile file{filename};
+  if (!file.isMapped())
+    return std::nullopt;
+
+  const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+  const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(file.data());
+  size_t size = file.size();
+
+  // Four independent lanes keep the multiplies pipelined
+  uint64_t lanes[4] = {PRIME1, PRIME2, ~PRIME1, ~PRIME2};
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32)
+    for (int j = 0; j < 4; ++j) {
+      uint64_t word;
+      std::memcpy(&word, p + i + j * 8, sizeof(word));
+      lanes[j] = rotl(lanes[j] + word * PRIME2, 31) * PRIME1;
+    }
+
+  uint64_t tail[4] = {0, 0, 0, 0};
+  std::memcpy(tail, p + i, size - i);
+  for (int j = 0; j < 4; ++j)
+    lanes[j] = rotl(lanes[j] + tail[j] * PRIME2, 31) * PRIME1;
+
+  uint64_t h = size;
+  for (int j = 0; j < 4; ++j)
+    h = fmix(h ^ lanes[j]);
+
+  return h;
+}
+
+static void putAccessMap(BinaryWriter &out, const AccessMap &map) {
+  out.put<uint64_t>(map.size());
+  for (const auto &[var, values] : map) {
+    out.put<vid_t>(var);
+    out.put<uint64_t>(values.size());
+    for (const auto &[value, ids] : values) {
+      out.put<uint32_t>(value);
+      out.put<uint64_t>(ids.size());
+      for (const auto &id : ids)
+        out.putEventId(id);
+    }
+  }
+}
+
+static AccessMap getAccessMap(BinaryReader &in,
+                              const std::vector<std::vector<Event>> &events) {
+  AccessMap map;
+  uint64_t numVars = in.getCount();
+  for (uint64_t i = 0; i < numVars; ++i) {
+    auto &values = map[in.get<vid_t>()];
+    uint64_t numValues = in.getCount();
+    for (uint64_t j = 0; j < numValues; ++j) {
+      auto &ids = values[in.get<uint32_t>()];
+      uint64_t numIds = in.getCount();
+      ids.reserve(numIds);
+      for (uint64_t k = 0; k < numIds; ++k)
+        ids.push_back(in.getEventId(events));
+    }
+  }
+  return map;
+}
+
+void writePreprocessCache(const std::string &filename, uint64_t hash,
+                          const PreprocessResult &pr) {
+  const CommonArg &arg = pr.arg;
+  BinaryWriter out;
+
+  out.putBytes(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  out.put<uint32_t>(CACHE_VERSION);
+  out.put<uint64_t>(hash);
+  out.put<uint64_t>(arg.events.size());
+  for (const auto &thread : arg.events)
+    out.put<uint64_t>(thread.size());
+
+  putAccessMap(out, arg.var_to_write_map);
+  putAccessMap(out, arg.var_to_read_map);
+
+  out.put<uint64_t>(arg.tid_map.size());
+  for (const auto &[thread, tid] : arg.tid_map) {
+    out.put<uint32_t>(thread);
+    out.put<tid_t>(tid);
+  }
+
+  out.put<uint64_t>(arg.acq_rel_map.size());
+  for (const auto &[acq, rel] : arg.acq_rel_map) {
+    out.putEventId(acq);
+    out.putEventId(rel);
+  }
+
+  out.put<uint64_t>(arg.begin_fork_map.size());
+  for (const auto &[tid, fork] : arg.begin_fork_map) {
+    out.put<tid_t>(tid);
+    out.putEventId(fork);
+  }
+
+  arg.closure.serialize(out);
+
+  out.put<uint64_t>(pr.cops.size());
+  for (const auto &[e1, e2] : pr.cops) {
+    out.putEventId(e1);
+    out.putEventId(e2);
+  }
+
+  // Write to a temporary file first so concurrent runs never see a partial
+  // cache file
+  std::string tmp = filename + ".tmp" + std::to_string(::getpid());
+  writeBinaryFile(tmp, out.data().data(), out.size());
+  std::filesystem::rename(tmp, filename);
+}
+
+std::optional<PreprocessResult>
+readPreprocessCache(const std::string &filename, uint64_t hash,
+                    std::vector<std::vector<Event>> &events) {
+  if (!std::filesystem::exists(filename))
+    return std::nullopt;
+
+  MappedFile file{filename};
+  if (!file.isMapped())
+    return std::nullopt;
+
+  BinaryReader in{file.data(), file.size()};
+  if (std::memcmp(in.getBytes(sizeof(CACHE_MAGIC)), CACHE_MAGIC,
+                  sizeof(CACHE_MAGIC)) != 0 ||
+      in.get<uint32_t>() != CACHE_VERSION || in.get<uint64_t>() != hash)
+    return std::nullopt;
+
+  if (in.get<uint64_t>() != events.size())
+    return std::nullopt;
+  for (const auto &thread : events)
+    if (in.get<uint64_t>() != thread.size())
+      return std::nullopt;
+
+  PreprocessResult pr;
+  CommonArg &arg = pr.arg;
+  arg.events = events;
+  arg.var_to_write_map = getAccessMap(in, events);
+  arg.var_to_read_map = getAccessMap(in, events);
+
+  uint64_t numThreads = in.getCount();
+  for (uint64_t i = 0; i < numThreads; ++i) {
+    uint32_t thread = in.get<uint32_t>();
+    tid_t tid = in.get<tid_t>();
+    if (tid >= events.size())
+      throw FormatError{"thread id out of range"};
+    arg.tid_map[thread] = tid;
+  }
+
+  // A release without an acquire is keyed by the unset EventId
+  uint64_t numAcquires = in.getCount();
+  for (uint64_t i = 0; i < numAcquires; ++i) {
+    EventId acq = in.getEventId(events, true);
+    arg.acq_rel_map[acq] = in.getEventId(events);
+  }
+
+  uint64_t numForks = in.getCount();
+  for (uint64_t i = 0; i < numForks; ++i) {
+    tid_t tid = in.get<tid_t>();
+    arg.begin_fork_map[tid] = in.getEventId(events);
+  }
+
+  arg.closure = Closure::deserialize(in, events);
+  arg.thread_accesses = indexAccesses(arg.events);
+
+  uint64_t numCops = in.getCount();
+  pr.cops.reserve(numCops);
+  for (uint64_t i = 0; i < numCops; ++i) {
+    EventId e1 = in.getEventId(events);
+    EventId e2 = in.getEventId(events);
+    pr.cops.insert({e1, e2});
+  }
+
+  return pr;
+}
+
+PreprocessResult
+preprocessCached(std::vector<std::vector<Event>> &events,
+                 std::unordered_map<uint32_t, tid_t> &thread_to_tid_map,
+                 Option &opts) {
+  size_t num_threads =
+      opts.num_threads.value_or(std::thread::hardware_concurrency());
+
+  if (!opts.cacheDir || !opts.inputFile)
+    return preprocess(events, thread_to_tid_map, num_threads);
+
+  std::optional<uint64_t> hash = hashFile(opts.inputFile.value());
+  if (!hash)
+    return preprocess(events, thread_to_tid_map, num_threads);
+
+  std::filesystem::path cacheFile = std::filesystem::path(opts.cacheDir.value()) /
+                                    std::format("{:016x}.cache", hash.value());
+
+  try {
+    if (auto cached = readPreprocessCache(cacheFile, hash.value(), events)) {
+      if (opts.verbose)
+        std::cout << "Loaded preprocessing cache " << cacheFile.string()
+                  << std::endl;
+      return std::move(cached.value());
+    }
+  } catch (const FormatError &e) {
+    std::cerr << "Ignoring preprocessing cache " << cacheFile.string() << ": "
+              << e.what() << std::endl;
+  }
+
+  PreprocessResult pr = preprocess(events, thread_to_tid_map, num_threads);
+
+  try {
+    std::filesystem::create_directories(opts.cacheDir.value());
+    writePreprocessCache(cacheFile, hash.value(), pr);
+  } catch (const std::exception &e) {
+    std::cerr << "Failed to write preprocessing cache: " << e.what()
+              << std::endl;
+  }
+
+  return pr;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "config.hpp"
+#include "event.hpp"
+#include "preprocesser.hpp"
+
+/*
+** On-disk cache of preprocess() results.
+**
+** Cache files are named after a hash of the input trace's contents and hold
+** everything in CommonArg except the events themselves, plus the COP set.
+** Events are always taken from the parsed trace, which also lets a cache file
+** be checked against the trace it is loaded for. Indexes derived from the
+** events alone, such as thread_accesses, are rebuilt on load.
+*/
+
+const char CACHE_MAGIC[8] = {'E', 'R', 'D', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t CACHE_VERSION = 6;
+
+/* Returns a 64-bit hash of the contents of filename, or nothing if the file
+ * cannot be mapped */
+std::optional<uint64_t> hashFile(const std::string &filename);
+
+/* Runs preprocess(), going through the cache in opts.cacheDir if set */
+PreprocessResult
+preprocessCached(std::vector<std::vector<Event>> &events,
+                 std::unordered_map<uint32_t, tid_t> &thread_to_tid_map,
+                 Option &opts);
+
+/* Writes a preprocessing result for the trace with the given hash */
+void writePreprocessCache(const std::string &filename, uint64_t hash,
+                          const PreprocessResult &pr);
+
+/* Reads a preprocessing result, returns nothing if the cache file is missing
+ * or was written for a different trace */
+std::optional<PreprocessResult>
+readPreprocessCache(const std::string &filename, uint64_t hash,
+                    std::vector<std::vector<Event>> &events);
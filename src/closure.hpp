@@ -1,8 +1,11 @@
 #pragma once
 
 #include "event.hpp"
+#include "kernels.hpp"
+#include "serialize.hpp"
 #include <algorithm>
-#include <cassert>
+#include <numeric>
+#include <span>
 #include <unordered_map>
 #include <vector>
 
@@ -42,101 +45,436 @@ private:
 
     /* Clocks c1 < c2 for event e1, e2 iff e1 is ordered before e2 by Closure */
     bool operator<(const Clock &other) const {
-      for (auto i = 0; i < ts.size(); ++i)
-        if (ts[i] > other.ts[i])
-          return false;
-
-      return true;
+      return clockLessOrEqual(ts.data(), other.ts.data(), ts.size());
     }
 
-    Clock join(const Clock &other) {
-      Clock joined{static_cast<uint32_t>(ts.size())};
-      for (auto i = 0; i < ts.size(); ++i) {
-        joined[i] = std::max(ts[i], other.ts[i]);
-      }
+    /* Joins other into this clock in place */
+    Clock &join(const Clock &other) {
+      joinClock(ts.data(), other.ts.data(), ts.size());
+      return *this;
+    }
 
-      return joined;
+    Clock &join(const uint32_t *other) {
+      joinClock(ts.data(), other, ts.size());
+      return *this;
     }
 
-    Clock incr(const tid_t tid) {
-      Clock newClock{*this};
-      ++newClock[tid];
-      return newClock;
+    Clock &incr(const tid_t tid) {
+      ++ts[tid];
+      return *this;
     }
 
-    const std::vector<uint32_t> getTimestamps() { return ts; }
+    const std::vector<uint32_t> &getTimestamps() const { return ts; }
   };
 
-  std::unordered_map<EventId, Clock> event_clocks;
-  std::unordered_map<EventId, std::vector<EventId>> transitive_reduction;
+  /* Point from which a thread's clock entry for another thread has value */
+  struct ClockChange {
+    uint32_t eid;
+    uint32_t value;
+  };
+
+  uint32_t numThreads = 0;
+  bool sparse = false;
+
+  /* Dense storage, used for up to SPARSE_CLOCK_THRESHOLD threads. Each
+   * thread's clocks are stored back to back as rows of numThreads timestamps,
+   * indexed by eid */
+  std::vector<std::vector<uint32_t>> thread_clocks;
+
+  /* Sparse storage, used above SPARSE_CLOCK_THRESHOLD threads.
+   * clock_changes[u] lists the points at which thread u's entry for each
+   * other thread t increases, grouped by t starting at change_offsets[u][t].
+   * An event's entry for its own thread is always its eid + 1 and is not
+   * stored. */
+  std::vector<std::vector<uint32_t>> change_offsets;
+  std::vector<std::vector<ClockChange>> clock_changes;
+
+  /* Transitive reduction in compressed sparse row form. The direct
+   * predecessors of (tid, eid) are reduction_preds[tid] from
+   * reduction_offsets[tid][eid] up to reduction_offsets[tid][eid + 1]. */
+  std::vector<std::vector<uint32_t>> reduction_offsets;
+  std::vector<std::vector<EventId>> reduction_preds;
+
+  const uint32_t *clockOf(const EventId &e) const {
+    return thread_clocks[e.getTid()].data() + e.getEid() * numThreads;
+  }
 
 public:
+  /* Thread count above which clocks are built from change logs and stored
+   * sparsely */
+  static const uint32_t SPARSE_CLOCK_THRESHOLD = 64;
+
   Closure() = default;
-  Closure(
-      std::unordered_map<EventId, Clock> clocks_,
-      std::unordered_map<EventId, std::vector<EventId>> transitive_reduction_)
-      : event_clocks{clocks_}, transitive_reduction{transitive_reduction_} {}
   Closure(const Closure &) = default;
   Closure(Closure &&) = default;
   Closure &operator=(const Closure &) = default;
   Closure &operator=(Closure &&) = default;
 
-  /* Returns if e1 < e2 */
-  bool happensBefore(const EventId &e1, const EventId &e2) {
-    return event_clocks.at(e1) < event_clocks.at(e2);
+  /* Returns the epoch of e, i.e. its own component of its clock */
+  uint32_t epochOf(const EventId &e) const {
+    if (sparse)
+      return e.getEid() + 1;
+
+    return clockOf(e)[e.getTid()];
+  }
+
+  /* Returns the latest epoch of thread tid ordered before or at e. Clocks
+   * leave out an event's direct predecessors, e.g. a read's sole writer, but
+   * the events after it in its thread see them. */
+  uint32_t clockAt(const EventId &e, tid_t tid) const {
+    if (!sparse)
+      return clockOf(e)[tid];
+
+    if (tid == e.getTid())
+      return e.getEid() + 1;
+
+    const std::vector<uint32_t> &offsets = change_offsets[e.getTid()];
+    auto begin = clock_changes[e.getTid()].begin() + offsets[tid];
+    auto end = clock_changes[e.getTid()].begin() + offsets[tid + 1];
+    auto it = std::upper_bound(
+        begin, end, e.getEid(),
+        [](eid_t eid, const ClockChange &c) { return eid < c.eid; });
+
+    return it == begin ? 0 : std::prev(it)->value;
+  }
+
+  /* Returns if e1 < e2 other than through e2's direct predecessors, so a read
+   * and an access racing with it stay unordered by the read's own sole writer.
+   * Since every clock carries its thread's history, e1 is ordered before e2
+   * iff e2 has seen e1's epoch, so only one component of e2's clock is
+   * compared. */
+  bool happensBefore(const EventId &e1, const EventId &e2) const {
+    return epochOf(e1) <= clockAt(e2, e1.getTid());
+  }
+
+  /* Returns if e1 < e2 by comparing their full clocks, O(numThreads) */
+  bool happensBeforeFull(const EventId &e1, const EventId &e2) const {
+    if (!sparse)
+      return clockLessOrEqual(clockOf(e1), clockOf(e2), numThreads);
+
+    for (tid_t t = 0; t < numThreads; ++t)
+      if (clockAt(e1, t) > clockAt(e2, t))
+        return false;
+
+    return true;
   }
 
   /* Returns transitive reduction of Closure for event e. I.e., direct
    * "dependencies" that must happen before e. */
-  std::vector<EventId> &getHappensBefore(const EventId &e) {
-    return transitive_reduction[e];
+  std::span<const EventId> getHappensBefore(const EventId &e) const {
+    // Sentinel eids such as UNUSED are out of range, not wrapped around
+    if (e.getTid() >= reduction_offsets.size() ||
+        reduction_offsets[e.getTid()].empty() ||
+        e.getEid() >= reduction_offsets[e.getTid()].size() - 1)
+      return {};
+
+    const std::vector<uint32_t> &offsets = reduction_offsets[e.getTid()];
+    return std::span<const EventId>{reduction_preds[e.getTid()]}.subspan(
+        offsets[e.getEid()], offsets[e.getEid() + 1] - offsets[e.getEid()]);
+  }
+
+  /* Writes clocks and transitive reduction for the preprocessing cache */
+  void serialize(BinaryWriter &out) const {
+    out.put<uint32_t>(numThreads);
+    out.put<uint8_t>(sparse);
+    if (sparse) {
+      out.put<uint64_t>(clock_changes.size());
+      for (tid_t u = 0; u < clock_changes.size(); ++u) {
+        out.putVector(change_offsets[u]);
+        out.putVector(clock_changes[u]);
+      }
+    } else {
+      out.put<uint64_t>(thread_clocks.size());
+      for (const auto &clocks : thread_clocks)
+        out.putVector(clocks);
+    }
+
+    out.put<uint64_t>(reduction_offsets.size());
+    for (tid_t tid = 0; tid < reduction_offsets.size(); ++tid) {
+      out.putVector(reduction_offsets[tid]);
+      out.put<uint64_t>(reduction_preds[tid].size());
+      for (const auto &pred : reduction_preds[tid])
+        out.putEventId(pred);
+    }
+  }
+
+  /* Reads what serialize wrote for a closure of events. Throws FormatError
+   * unless it has a clock and predecessors for exactly the events of events,
+   * and only refers to those. */
+  static Closure deserialize(BinaryReader &in,
+                             const std::vector<std::vector<Event>> &events) {
+    Closure clj;
+    clj.numThreads = in.get<uint32_t>();
+    clj.sparse = in.get<uint8_t>();
+    if (clj.numThreads != events.size())
+      throw FormatError{"closure does not match thread count"};
+
+    if (clj.sparse) {
+      uint64_t n = in.getCount();
+      if (n != events.size())
+        throw FormatError{"clock changes do not match thread count"};
+      clj.change_offsets.resize(n);
+      clj.clock_changes.resize(n);
+      for (tid_t u = 0; u < n; ++u) {
+        clj.change_offsets[u] = in.getVector<uint32_t>();
+        clj.clock_changes[u] = in.getVector<ClockChange>();
+
+        const std::vector<uint32_t> &offsets = clj.change_offsets[u];
+        if (offsets.size() != clj.numThreads + 1 ||
+            offsets.back() != clj.clock_changes[u].size() ||
+            !std::is_sorted(offsets.begin(), offsets.end()))
+          throw FormatError{"clock changes do not match thread count"};
+      }
+    } else {
+      uint64_t n = in.getCount();
+      if (n != events.size())
+        throw FormatError{"clock rows do not match thread count"};
+      clj.thread_clocks.resize(n);
+      for (tid_t tid = 0; tid < n; ++tid) {
+        clj.thread_clocks[tid] = in.getVector<uint32_t>();
+        if (clj.thread_clocks[tid].size() !=
+            events[tid].size() * static_cast<uint64_t>(clj.numThreads))
+          throw FormatError{"clock rows do not match thread count"};
+      }
+    }
+
+    uint64_t n = in.getCount();
+    if (n != events.size())
+      throw FormatError{"transitive reduction does not match thread count"};
+    clj.reduction_offsets.resize(n);
+    clj.reduction_preds.resize(n);
+    for (tid_t tid = 0; tid < n; ++tid) {
+      clj.reduction_offsets[tid] = in.getVector<uint32_t>();
+      uint64_t numPreds = in.getCount();
+      clj.reduction_preds[tid].reserve(numPreds);
+      for (uint64_t j = 0; j < numPreds; ++j)
+        clj.reduction_preds[tid].push_back(in.getEventId(events));
+
+      const std::vector<uint32_t> &offsets = clj.reduction_offsets[tid];
+      if (offsets.size() != events[tid].size() + 1 ||
+          offsets.back() != numPreds ||
+          !std::is_sorted(offsets.begin(), offsets.end()))
+        throw FormatError{"transitive reduction offsets out of range"};
+    }
+
+    return clj;
   }
 
   class Builder {
   private:
     std::unordered_map<EventId, std::vector<EventId>> transitive_reduction;
     uint32_t numThreads;
+    bool sparse;
 
-  public:
-    Builder(uint32_t numThreads_) : numThreads{numThreads_} {}
-
-    /* Add partial ordering in which e2 happens before e1 */
-    void addRelation(const EventId &e1, const EventId &e2) {
-      transitive_reduction[e1].push_back(e2);
-    }
-
-    /* Vector clock algorithm to compute Closure */
-    Closure build(std::vector<Event> &events,
-                  std::vector<std::vector<Event>> &allEvents) {
-      std::unordered_map<EventId, Clock> clocks;
+    /* Vector clock algorithm writing every event's clock into dense rows.
+     * A row is its thread's clock before the event joins its direct
+     * predecessors; the thread clock keeps them for the events after it. */
+    void buildDense(Closure &clj, std::vector<Event> &events,
+                    std::vector<std::vector<Event>> &allEvents) {
+      std::vector<std::vector<uint32_t>> &clocks = clj.thread_clocks;
       std::vector<Clock> threadClocks;
       std::vector<eid_t> eids;
+      std::vector<EventId> pending;
 
+      clocks.resize(numThreads);
       for (auto i = 0; i < numThreads; ++i) {
         eids.push_back(0);
         threadClocks.push_back(Clock{numThreads});
+        clocks[i].resize(allEvents[i].size() * numThreads);
       }
 
       for (auto e : events) {
         tid_t tid = e.getThreadId();
         eid_t eid = eids[tid];
 
-        Clock c = threadClocks[tid];
-        c = c.incr(tid);
-        threadClocks[tid] = c;
+        Clock &c = threadClocks[tid].incr(tid);
+        uint32_t *row = clocks[tid].data() + eid * numThreads;
+        std::copy(c.getTimestamps().begin(), c.getTimestamps().end(), row);
+
+        // Join clocks. Rows leave out their own predecessors, so those of a
+        // predecessor are joined as well.
+        std::span<const EventId> preds = clj.getHappensBefore({tid, eid});
+        pending.assign(preds.begin(), preds.end());
+        while (!pending.empty()) {
+          EventId prevEvent = pending.back();
+          pending.pop_back();
+
+          // E.g. a read of a value its sole writer only writes later
+          if (prevEvent.getEid() >= eids[prevEvent.getTid()])
+            throw FormatError{"event ordered after a later event"};
+          c.join(clocks[prevEvent.getTid()].data() +
+                 prevEvent.getEid() * numThreads);
+          std::span<const EventId> morePreds = clj.getHappensBefore(prevEvent);
+          pending.insert(pending.end(), morePreds.begin(), morePreds.end());
+        }
+
+        ++eids[tid];
+      }
+    }
+
+    /* Vector clock algorithm recording only the entries each join changes.
+     * Besides those changes, each thread logs what its clock learns in
+     * program order. A clock that has seen epoch k of thread u has seen all
+     * of u's clock up to that point, so joining an event of u replays only
+     * u's log from k on. Every numThreads log entries the whole clock is
+     * kept as a checkpoint, so that a join never replays much more than
+     * numThreads entries. Changes show from the event after the join, as
+     * events' clocks leave out their own predecessors. */
+    void buildSparse(Closure &clj, std::vector<Event> &events) {
+      struct LogEntry {
+        uint32_t eid;
+        tid_t tid;
+        uint32_t value;
+      };
+
+      /* Clock after event eid, with the log up to logEnd */
+      struct Checkpoint {
+        uint32_t eid;
+        size_t logEnd;
+      };
+
+      std::vector<std::vector<uint32_t>> threadClocks(
+          numThreads, std::vector<uint32_t>(numThreads, 0));
+      std::vector<std::vector<LogEntry>> logs(numThreads);
+      std::vector<std::vector<Checkpoint>> checkpoints(numThreads);
+      std::vector<std::vector<uint32_t>> checkpointClocks(numThreads);
+      std::vector<std::vector<std::vector<ClockChange>>> changes(
+          numThreads, std::vector<std::vector<ClockChange>>(numThreads));
+      std::vector<eid_t> eids(numThreads, 0);
+
+      for (auto e : events) {
+        tid_t tid = e.getThreadId();
+        uint32_t eid = eids[tid];
+
+        std::vector<uint32_t> &c = threadClocks[tid];
+        c[tid] = eid + 1;
+
+        auto update = [&](tid_t t, uint32_t value) {
+          if (value <= c[t])
+            return;
+
+          c[t] = value;
+          logs[tid].push_back({eid, t, value});
+
+          std::vector<ClockChange> &points = changes[tid][t];
+          if (!points.empty() && points.back().eid == eid + 1)
+            points.back().value = value;
+          else
+            points.push_back({eid + 1, value});
+        };
 
-        // Join clocks
-        for (auto prevEvent : transitive_reduction[EventId{tid, eid}]) {
-          assert(clocks.find(prevEvent) != clocks.end());
-          c = c.join(clocks.at(prevEvent));
+        for (auto prevEvent : clj.getHappensBefore({tid, eid})) {
+          tid_t u = prevEvent.getTid();
+
+          // E.g. a read of a value its sole writer only writes later
+          if (prevEvent.getEid() >= eids[u])
+            throw FormatError{"event ordered after a later event"};
+          if (prevEvent.getEid() < c[u])
+            continue;
+
+          const std::vector<LogEntry> &log = logs[u];
+          auto it = std::lower_bound(
+              log.begin(), log.end(), c[u],
+              [](const LogEntry &l, uint32_t eid) { return l.eid < eid; });
+          auto end = std::upper_bound(
+              it, log.end(), prevEvent.getEid(),
+              [](eid_t eid, const LogEntry &l) { return eid < l.eid; });
+
+          // Start from the last checkpoint at or before prevEvent if that
+          // skips more entries than a clock has
+          const std::vector<Checkpoint> &points = checkpoints[u];
+          auto point = std::upper_bound(
+              points.begin(), points.end(), prevEvent.getEid(),
+              [](eid_t eid, const Checkpoint &p) { return eid < p.eid; });
+          if (point != points.begin() &&
+              log.begin() + std::prev(point)->logEnd - it > numThreads) {
+            --point;
+            const uint32_t *clock = checkpointClocks[u].data() +
+                                    (point - points.begin()) * numThreads;
+            for (tid_t t = 0; t < numThreads; ++t)
+              update(t, clock[t]);
+            it = log.begin() + point->logEnd;
+          }
+
+          for (; it != end; ++it)
+            update(it->tid, it->value);
+          update(u, prevEvent.getEid() + 1);
         }
 
-        clocks.emplace(EventId{tid, eid}, c);
+        size_t logEnd = checkpoints[tid].empty()
+                            ? 0
+                            : checkpoints[tid].back().logEnd;
+        if (logs[tid].size() - logEnd >= numThreads) {
+          checkpoints[tid].push_back({eid, logs[tid].size()});
+          checkpointClocks[tid].insert(checkpointClocks[tid].end(), c.begin(),
+                                       c.end());
+        }
 
         ++eids[tid];
       }
 
-      return Closure{clocks, transitive_reduction};
+      clj.change_offsets.resize(numThreads);
+      clj.clock_changes.resize(numThreads);
+      for (tid_t u = 0; u < numThreads; ++u) {
+        std::vector<uint32_t> &offsets = clj.change_offsets[u];
+        for (tid_t t = 0; t < numThreads; ++t) {
+          offsets.push_back(clj.clock_changes[u].size());
+          clj.clock_changes[u].insert(clj.clock_changes[u].end(),
+                                      changes[u][t].begin(),
+                                      changes[u][t].end());
+        }
+        offsets.push_back(clj.clock_changes[u].size());
+      }
+    }
+
+  public:
+    Builder(uint32_t numThreads_)
+        : Builder{numThreads_, numThreads_ > SPARSE_CLOCK_THRESHOLD} {}
+
+    /* Stores clocks sparsely or not regardless of the thread count */
+    Builder(uint32_t numThreads_, bool sparse_)
+        : numThreads{numThreads_}, sparse{sparse_} {}
+
+    /* Add partial ordering in which e2 happens before e1 */
+    void addRelation(const EventId &e1, const EventId &e2) {
+      transitive_reduction[e1].push_back(e2);
+    }
+
+    /* Computes Closure with vector clocks, stored sparsely above
+     * SPARSE_CLOCK_THRESHOLD threads unless the Builder was told otherwise.
+     * Clocks are written directly into the storage of the resulting
+     * Closure. */
+    Closure build(std::vector<Event> &events,
+                  std::vector<std::vector<Event>> &allEvents) {
+      Closure clj;
+      clj.numThreads = numThreads;
+      clj.sparse = sparse;
+
+      // Freeze the transitive reduction into CSR form first, so the clock
+      // algorithms look predecessors up without hashing
+      clj.reduction_offsets.resize(numThreads);
+      clj.reduction_preds.resize(numThreads);
+      for (tid_t tid = 0; tid < numThreads; ++tid)
+        clj.reduction_offsets[tid].assign(allEvents[tid].size() + 1, 0);
+      for (const auto &[id, preds] : transitive_reduction)
+        clj.reduction_offsets[id.getTid()][id.getEid() + 1] = preds.size();
+      for (tid_t tid = 0; tid < numThreads; ++tid) {
+        std::vector<uint32_t> &offsets = clj.reduction_offsets[tid];
+        std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+        clj.reduction_preds[tid].resize(offsets.back());
+      }
+      for (const auto &[id, preds] : transitive_reduction)
+        std::copy(preds.begin(), preds.end(),
+                  clj.reduction_preds[id.getTid()].begin() +
+                      clj.reduction_offsets[id.getTid()][id.getEid()]);
+
+      if (clj.sparse)
+        buildSparse(clj, events);
+      else
+        buildDense(clj, events, allEvents);
+
+      transitive_reduction.clear();
+      return clj;
     }
   };
 };
@@ -5,6 +5,10 @@
 #include <optional>
 #include <string>
 
+#include "budget.hpp"
+#include "strategy.hpp"
+#include "visited.hpp"
+
 /*
 ** Handles cli flags and args
 */
@@ -16,6 +20,35 @@ struct Option {
   std::optional<size_t> num_threads;
   std::optional<std::string> inputFile;
   std::optional<std::string> outputDir;
+  std::optional<std::string> cacheDir;
+
+  /* Limits per COP, and the factor they grow by when retrying pairs that ran
+   * out of budget */
+  SearchBudget budget;
+  std::optional<double> retryFactor;
+
+  /* How searches store visited states */
+  VisitedMode visited = VisitedMode::EXACT;
+
+  /* Skips interleavings of commuting events with sleep sets */
+  bool por = false;
+
+  /* Confirms sync-preserving races before searching, see SyncPreserving */
+  bool syncPreserving = false;
+
+  /* Decides other COPs from the states each search explores, see
+   * VerdictBoard::harvest. Which races are found then depends on the order
+   * searches run in. */
+  bool harvest = false;
+
+  /* Order searches expand reorderings in, and the weights of their
+   * heuristic */
+  SearchStrategy strategy = SearchStrategy::BEST_FIRST;
+  size_t beamWidth = 64;
+  SearchWeights weights;
+
+  /* Races two strategies on each COP, taking the first verdict */
+  std::optional<std::pair<SearchStrategy, SearchStrategy>> portfolio;
 };
 
 typedef std::function<void(Option &)> NoArgHandle;
@@ -25,6 +58,12 @@ const std::unordered_map<std::string, NoArgHandle> NoArgs{
 
     {"--witness", [](Option &s) { s.witness = true; }},
     {"-w", [](Option &s) { s.witness = true; }},
+
+    {"--por", [](Option &s) { s.por = true; }},
+
+    {"--syncp", [](Option &s) { s.syncPreserving = true; }},
+
+    {"--harvest", [](Option &s) { s.harvest = true; }},
 };
 
 typedef std::function<void(Option &, const std::string &)> OneArgHandle;
@@ -33,6 +72,83 @@ const std::unordered_map<std::string, OneArgHandle> OneArgs{
     {"--outputDir",
      [](Option &s, const std::string &out) { s.outputDir = out; }},
 
+    {"-c", [](Option &s, const std::string &dir) { s.cacheDir = dir; }},
+    {"--cacheDir",
+     [](Option &s, const std::string &dir) { s.cacheDir = dir; }},
+
+    {"--maxNodes",
+     [](Option &s, const std::string &str) {
+       try {
+         s.budget.nodes = std::stoull(str);
+       } catch (const std::exception &e) {
+         std::cerr << "Conversion failed: " << e.what() << std::endl;
+         throw std::runtime_error{"Invalid argument for maxNodes"};
+       }
+     }},
+    {"--maxTime",
+     [](Option &s, const std::string &str) {
+       try {
+         s.budget.seconds = std::stod(str);
+       } catch (const std::exception &e) {
+         std::cerr << "Conversion failed: " << e.what() << std::endl;
+         throw std::runtime_error{"Invalid argument for maxTime"};
+       }
+     }},
+    {"--maxMemory",
+     [](Option &s, const std::string &str) {
+       try {
+         s.budget.bytes = static_cast<size_t>(std::stoull(str)) << 20;
+       } catch (const std::exception &e) {
+         std::cerr << "Conversion failed: " << e.what() << std::endl;
+         throw std::runtime_error{"Invalid argument for maxMemory"};
+       }
+     }},
+    {"--retry",
+     [](Option &s, const std::string &str) {
+       double factor;
+       try {
+         factor = std::stod(str);
+       } catch (const std::exception &e) {
+         std::cerr << "Conversion failed: " << e.what() << std::endl;
+         throw std::runtime_error{"Invalid argument for retry"};
+       }
+       if (!(factor > 1))
+         throw std::runtime_error{"Retry factor must be greater than 1"};
+       s.retryFactor = factor;
+     }},
+
+    {"--fingerprint",
+     [](Option &s, const std::string &str) {
+       if (str == "64")
+         s.visited = VisitedMode::FINGERPRINT_64;
+       else if (str == "128")
+         s.visited = VisitedMode::FINGERPRINT_128;
+       else
+         throw std::runtime_error{"Fingerprint size must be 64 or 128"};
+     }},
+
+    {"--strategy",
+     [](Option &s, const std::string &str) {
+       s.strategy = parseStrategy(str);
+     }},
+    {"--beamWidth",
+     [](Option &s, const std::string &str) {
+       try {
+         s.beamWidth = std::stoull(str);
+       } catch (const std::exception &e) {
+         std::cerr << "Conversion failed: " << e.what() << std::endl;
+         throw std::runtime_error{"Invalid argument for beamWidth"};
+       }
+       if (s.beamWidth == 0)
+         throw std::runtime_error{"Beam width must be positive"};
+     }},
+    {"--weights",
+     [](Option &s, const std::string &str) { parseWeights(s.weights, str); }},
+    {"--portfolio",
+     [](Option &s, const std::string &str) {
+       s.portfolio = parsePortfolio(str);
+     }},
+
     {"-p",
      [](Option &s, const std::string &str) {
        try {
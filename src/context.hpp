@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "config.hpp"
+#include "event.hpp"
+#include "frontier.hpp"
+#include "parallel.hpp"
+#include "preprocesser.hpp"
+#include "visited.hpp"
+
+/* Memory of the searches of one worker, kept from one COP to the next so that
+ * a search does not allocate its frontier, visited set and scratch buffers
+ * anew. Only used by one search at a time. */
+class SearchContext {
+private:
+  StateEncoder encoder;
+  VisitedSet seen;
+  Frontier frontier;
+  std::vector<uint8_t> key; // scratch space for state encodings
+
+  std::unique_ptr<SearchContext> partner; // second strategy of a portfolio
+  std::unique_ptr<HelperThread> partnerThread; // runs the partner's searches
+
+public:
+  SearchContext() = default;
+
+  SearchContext(const SearchContext &) = delete;
+  SearchContext &operator=(const SearchContext &) = delete;
+
+  /* Prepares for a search of COP (e1, e2) with include set iset, with
+   * numShards shards of the visited set. The visited set starts small and
+   * grows with the states the search visits. */
+  void reset(CommonArg &arg, const std::vector<eid_t> &iset, EventId e1,
+             EventId e2, const Option &opt, SearchStrategy strategy,
+             size_t numShards) {
+    encoder.reset(arg, iset);
+    seen.reset(opt.visited, numShards, opt.por);
+    frontier.reset(strategy, opt.beamWidth, Trace::maxDepth(iset),
+                   Trace::maxPriority(e1, e2, opt.weights));
+  }
+
+  /* Drops the reorderings left once a search is done, which must happen
+   * before the arena they were allocated from is reset */
+  void release() { frontier.reset(SearchStrategy::BEST_FIRST, 0); }
+
+  StateEncoder &getEncoder() { return encoder; }
+  VisitedSet &getSeen() { return seen; }
+  Frontier &getFrontier() { return frontier; }
+  std::vector<uint8_t> &getKey() { return key; }
+
+  /* Context for a search running alongside this one */
+  SearchContext &getPartner() {
+    if (partner == nullptr)
+      partner = std::make_unique<SearchContext>();
+    return *partner;
+  }
+
+  /* Thread for the searches of the partner, kept from one COP to the next */
+  HelperThread &getPartnerThread() {
+    if (partnerThread == nullptr)
+      partnerThread = std::make_unique<HelperThread>();
+    return *partnerThread;
+  }
+};
@@ -2,6 +2,7 @@
 
 #include <format>
 #include <stdexcept>
+#include <string>
 
 class EncodingError : public std::runtime_error {
 public:
@@ -9,3 +10,9 @@ public:
       : std::runtime_error(std::format(
             "Error parsing input at event {}, raw event: {}", i, rawEvent)) {}
 };
+
+class FormatError : public std::runtime_error {
+public:
+  explicit FormatError(const std::string &what)
+      : std::runtime_error(std::format("Malformed input: {}", what)) {}
+};
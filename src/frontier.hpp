@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "bucketqueue.hpp"
+#include "strategy.hpp"
+#include "trace.hpp"
+
+/* Reorderings ordered by their strategyKey */
+typedef BucketQueue<std::shared_ptr<Trace>> NodeQueue;
+
+/* Reorderings waiting to be expanded by a search, in the order of its
+ * strategy */
+class Frontier {
+private:
+  SearchStrategy strategy;
+  size_t width; // BEAM only
+  uint32_t maxDepth = 0;
+  NodeQueue nodes;
+
+  // Depth of the last reordering expanded by a beam search, and how many
+  // were expanded at that depth
+  uint32_t depth = 0;
+  size_t expanded = 0;
+  bool pruned = false;
+
+public:
+  explicit Frontier(SearchStrategy strategy_ = SearchStrategy::BEST_FIRST,
+                    size_t width_ = 0)
+      : strategy{strategy_}, width{width_} {}
+
+  /* Empties the frontier for a new search in the given order, whose
+   * reorderings are at most maxDepth_ deep and have priorities up to
+   * maxPriority */
+  void reset(SearchStrategy strategy_, size_t width_, uint32_t maxDepth_ = 0,
+             uint32_t maxPriority = 0) {
+    strategy = strategy_;
+    width = width_;
+    maxDepth = maxDepth_;
+    nodes.reset(maxStrategyKey(strategy, maxDepth, maxPriority));
+    depth = 0;
+    expanded = 0;
+    pruned = false;
+  }
+
+  bool empty() const { return nodes.empty(); }
+  size_t size() const { return nodes.size(); }
+
+  const std::shared_ptr<Trace> &top() const { return nodes.top(); }
+  uint64_t topKey() const { return nodes.topKey(); }
+
+  void push(std::shared_ptr<Trace> t) {
+    uint64_t key =
+        strategyKey(strategy, t->getDepth(), t->getPriority(), maxDepth);
+    nodes.push(key, std::move(t));
+  }
+
+  void pop() { nodes.pop(); }
+
+  /* Returns if a beam search drops t, the reordering just popped, as it
+   * already expanded as many reorderings at the depth of t as it may. Nodes
+   * are popped in order of depth, so the best ones at each depth are kept. */
+  bool prune(const Trace &t) {
+    if (strategy != SearchStrategy::BEAM)
+      return false;
+
+    if (t.getDepth() != depth) {
+      depth = t.getDepth();
+      expanded = 0;
+    }
+
+    if (expanded < width) {
+      ++expanded;
+      return false;
+    }
+
+    pruned = true;
+    return true;
+  }
+
+  /* Returns if reorderings were dropped, i.e. an exhausted search proves
+   * nothing */
+  bool isPruned() const { return pruned; }
+
+  /* Returns if the search may continue on several threads, which only
+   * approximate the order of the frontier */
+  bool isShareable() const { return strategy != SearchStrategy::BEAM; }
+};
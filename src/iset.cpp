@@ -49,8 +49,8 @@ void IncludeSet::addGoodWrites(EventId e, std::vector<eid_t> &iset,
                                std::vector<std::vector<Event>> &events,
                                CommonArg &arg) {
   Event evt = getEvent(events, e);
-  std::vector<EventId> &writes =
-      arg.var_to_write_map[evt.getVarId()][evt.getVarValue()];
+  const std::vector<EventId> &writes =
+      getAccesses(arg.var_to_write_map, evt.getVarId(), evt.getVarValue());
 
   for (auto w : writes) {
     if (w.getTid() == e.getTid() && w.getEid() > e.getTid())
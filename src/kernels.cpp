@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CLOCK_KERNELS_X86
+#endif
+
+static void joinScalar(uint32_t *dst, const uint32_t *src, uint32_t n) {
+  for (uint32_t i = 0; i < n; ++i)
+    dst[i] = std::max(dst[i], src[i]);
+}
+
+static bool lessOrEqualScalar(const uint32_t *a, const uint32_t *b,
+                              uint32_t n) {
+  for (uint32_t i = 0; i < n; ++i)
+    if (a[i] > b[i])
+      return false;
+
+  return true;
+}
+
+static const ClockKernels SCALAR{"scalar", joinScalar, lessOrEqualScalar};
+
+#ifdef CLOCK_KERNELS_X86
+
+__attribute__((target("sse4.1"))) static void
+joinSSE(uint32_t *dst, const uint32_t *src, uint32_t n) {
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i),
+                     _mm_max_epu32(d, s));
+  }
+  joinScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("sse4.1"))) static bool
+lessOrEqualSSE(const uint32_t *a, const uint32_t *b, uint32_t n) {
+  uint32_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    // a <= b iff max(a, b) == b
+    __m128i le = _mm_cmpeq_epi32(_mm_max_epu32(x, y), y);
+    if (_mm_movemask_epi8(le) != 0xFFFF)
+      return false;
+  }
+  return lessOrEqualScalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2"))) static void
+joinAVX2(uint32_t *dst, const uint32_t *src, uint32_t n) {
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i),
+                        _mm256_max_epu32(d, s));
+  }
+  joinScalar(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2"))) static bool
+lessOrEqualAVX2(const uint32_t *a, const uint32_t *b, uint32_t n) {
+  uint32_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+    __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    __m256i le = _mm256_cmpeq_epi32(_mm256_max_epu32(x, y), y);
+    if (_mm256_movemask_epi8(le) != -1)
+      return false;
+  }
+  return lessOrEqualScalar(a + i, b + i, n - i);
+}
+
+static const ClockKernels SSE{"sse4.1", joinSSE, lessOrEqualSSE};
+static const ClockKernels AVX2{"avx2", joinAVX2, lessOrEqualAVX2};
+
+#endif
+
+std::vector<const ClockKernels *> availableClockKernels() {
+  std::vector<const ClockKernels *> kernels{&SCALAR};
+
+#ifdef CLOCK_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.1"))
+    kernels.push_back(&SSE);
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back(&AVX2);
+#endif
+
+  return kernels;
+}
+
+const ClockKernels &clockKernels() {
+  static const ClockKernels &selected = *availableClockKernels().back();
+  return selected;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+/*
+** Vector clock kernels over rows of uint32_t timestamps.
+**
+** Each kernel set has a scalar, an SSE4.1 and an AVX2 implementation. The
+** widest one supported by the CPU is picked on first use.
+*/
+
+struct ClockKernels {
+  const char *name;
+
+  /* Element-wise max of src into dst */
+  void (*join)(uint32_t *dst, const uint32_t *src, uint32_t n);
+
+  /* Returns if a <= b element-wise */
+  bool (*lessOrEqual)(const uint32_t *a, const uint32_t *b, uint32_t n);
+};
+
+/* Returns the kernels selected for this CPU */
+const ClockKernels &clockKernels();
+
+/* Returns all kernel sets this CPU can run, scalar first */
+std::vector<const ClockKernels *> availableClockKernels();
+
+inline void joinClock(uint32_t *dst, const uint32_t *src, uint32_t n) {
+  clockKernels().join(dst, src, n);
+}
+
+inline bool clockLessOrEqual(const uint32_t *a, const uint32_t *b,
+                             uint32_t n) {
+  return clockKernels().lessOrEqual(a, b, n);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "event.hpp"
+
+/* Identifier of an interned lockset, 0 is the empty lockset */
+typedef uint32_t lsid_t;
+
+/* Distinct sets of held locks, each stored once as a bitset over locks
+ * numbered in order of first use. Every event is mapped to the id of the
+ * lockset held by its thread when it executes. */
+class LocksetTable {
+private:
+  struct BitsetHash {
+    size_t operator()(const std::vector<uint64_t> &bits) const {
+      size_t h = bits.size();
+      for (auto w : bits)
+        h ^= std::hash<uint64_t>()(w) + 0x9e3779b97f4a7c15 + (h << 6) + (h >> 2);
+      return h;
+    }
+  };
+
+  std::unordered_map<vid_t, uint32_t> lock_index;
+
+  /* Bitsets of each lockset without trailing zero words, indexed by id */
+  std::vector<std::vector<uint64_t>> locksets{{}};
+  std::unordered_map<std::vector<uint64_t>, lsid_t, BitsetHash> lockset_ids{
+      {{}, 0}};
+
+  /* Lockset id of each event, per thread and indexed by eid */
+  std::vector<std::vector<lsid_t>> event_locksets;
+
+public:
+  LocksetTable() = default;
+
+  explicit LocksetTable(const std::vector<std::vector<Event>> &events)
+      : event_locksets(events.size()) {
+    for (tid_t i = 0; i < events.size(); ++i)
+      event_locksets[i].resize(events[i].size(), 0);
+  }
+
+  /* Returns the id of the set of locks, interning it on first use */
+  template <typename Locks> lsid_t intern(const Locks &locks) {
+    std::vector<uint64_t> bits;
+    for (vid_t l : locks) {
+      auto [it, _] = lock_index.try_emplace(l, lock_index.size());
+      size_t word = it->second / 64;
+      if (bits.size() <= word)
+        bits.resize(word + 1, 0);
+      bits[word] |= uint64_t{1} << (it->second % 64);
+    }
+
+    auto [it, inserted] = lockset_ids.try_emplace(bits, locksets.size());
+    if (inserted)
+      locksets.push_back(std::move(bits));
+
+    return it->second;
+  }
+
+  void setLockset(const EventId &e, lsid_t id) {
+    event_locksets[e.getTid()][e.getEid()] = id;
+  }
+
+  lsid_t getLockset(const EventId &e) const {
+    return event_locksets[e.getTid()][e.getEid()];
+  }
+
+  /* Returns the number of distinct locksets, including the empty one */
+  size_t size() const { return locksets.size(); }
+
+  /* Returns if locksets a and b have a lock in common */
+  bool intersects(lsid_t a, lsid_t b) const {
+    const std::vector<uint64_t> &bits1 = locksets[a];
+    const std::vector<uint64_t> &bits2 = locksets[b];
+    size_t n = std::min(bits1.size(), bits2.size());
+    for (size_t i = 0; i < n; ++i)
+      if (bits1[i] & bits2[i])
+        return true;
+
+    return false;
+  }
+};
+
+/* Answers common lock queries between events, remembering the result for each
+ * pair of locksets. Not thread safe, every worker keeps its own. */
+class LocksetCache {
+private:
+  const LocksetTable &table;
+  std::unordered_map<uint64_t, bool> memo;
+
+public:
+  explicit LocksetCache(const LocksetTable &table_) : table{table_} {}
+
+  bool hasCommonLock(const EventId &e1, const EventId &e2) {
+    lsid_t a = table.getLockset(e1);
+    lsid_t b = table.getLockset(e2);
+    if (a == 0 || b == 0)
+      return false;
+    if (a == b)
+      return true;
+    if (a > b)
+      std::swap(a, b);
+
+    auto [it, inserted] =
+        memo.try_emplace((static_cast<uint64_t>(a) << 32) | b, false);
+    if (inserted)
+      it->second = table.intersects(a, b);
+
+    return it->second;
+  }
+};
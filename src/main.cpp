@@ -2,6 +2,7 @@
 #include "parser.hpp"
 #include "predictor.hpp"
 #include <iostream>
+#include <thread>
 
 auto main(int argc, char *argv[]) -> int {
   if (argc < 2) {
@@ -13,7 +14,9 @@ auto main(int argc, char *argv[]) -> int {
     Option opts = parseOptions(argc, argv);
     auto start = std::chrono::high_resolution_clock::now();
 
-    ParseResult pr = parse(opts.inputFile.value());
+    ParseResult pr =
+        parse(opts.inputFile.value(),
+              opts.num_threads.value_or(std::thread::hardware_concurrency()));
     Predictor pred{pr, opts};
     pred.predict();
 
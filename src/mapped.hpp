@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Read-only memory mapping of a file.
+ *
+ * Only regular files are mapped. For anything else (pipes, character devices)
+ * isMapped() returns false and callers are expected to fall back to reading
+ * the file through a stream. */
+class MappedFile {
+private:
+  int fd = -1;
+  void *addr = nullptr;
+  size_t length = 0;
+  bool mapped = false;
+
+public:
+  explicit MappedFile(const std::string &filename) {
+    fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error{"Failed to open file " + filename};
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+      return;
+
+    length = static_cast<size_t>(st.st_size);
+    mapped = true;
+
+    // mmap rejects zero-length mappings, an empty file is simply empty
+    if (length == 0)
+      return;
+
+    addr = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      addr = nullptr;
+      length = 0;
+      mapped = false;
+      return;
+    }
+
+    ::madvise(addr, length, MADV_SEQUENTIAL);
+  }
+
+  ~MappedFile() {
+    if (addr != nullptr)
+      ::munmap(addr, length);
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /* Returns if the file is backed by a mapping */
+  bool isMapped() const { return mapped; }
+
+  const std::byte *data() const { return static_cast<std::byte *>(addr); }
+  size_t size() const { return length; }
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/* Runs f(0) .. f(n - 1) on n threads and waits for all of them. The first
+ * exception thrown by any f is rethrown on the calling thread. */
+template <typename F> void runParallel(size_t n, F f) {
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  std::vector<std::thread> workers;
+
+  for (size_t i = 0; i < n; ++i)
+    workers.emplace_back([&, i]() {
+      try {
+        f(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock{error_mutex};
+        if (!error)
+          error = std::current_exception();
+      }
+    });
+
+  for (auto &t : workers)
+    t.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+/* A thread kept alive to run one job at a time alongside its owner, so that
+ * short jobs do not pay for starting a thread each */
+class HelperThread {
+private:
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::function<void()> job; // set while a job is pending or running
+  std::exception_ptr error;
+  bool stopping = false;
+  std::thread thread;
+
+  void loop() {
+    std::unique_lock<std::mutex> lock{mutex};
+    while (true) {
+      changed.wait(lock, [this]() { return stopping || job; });
+      if (!job)
+        return;
+
+      lock.unlock();
+      try {
+        job();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      lock.lock();
+
+      job = nullptr;
+      changed.notify_all();
+    }
+  }
+
+public:
+  HelperThread() : thread{[this]() { loop(); }} {}
+
+  HelperThread(const HelperThread &) = delete;
+  HelperThread &operator=(const HelperThread &) = delete;
+
+  ~HelperThread() {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      stopping = true;
+    }
+    changed.notify_all();
+    thread.join();
+  }
+
+  /* Starts f on the helper thread, which must be idle */
+  void start(std::function<void()> f) {
+    {
+      std::lock_guard<std::mutex> lock{mutex};
+      job = std::move(f);
+    }
+    changed.notify_all();
+  }
+
+  /* Waits for the job started last, keeping an exception it threw for
+   * wait(). Safe to call while unwinding. */
+  void waitIdle() {
+    std::unique_lock<std::mutex> lock{mutex};
+    changed.wait(lock, [this]() { return !job; });
+  }
+
+  /* Waits for the job started last. An exception it threw is rethrown on the
+   * calling thread. */
+  void wait() {
+    waitIdle();
+    std::lock_guard<std::mutex> lock{mutex};
+    if (error)
+      std::rethrow_exception(std::exchange(error, nullptr));
+  }
+};
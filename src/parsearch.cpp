@@ -0,0 +1,266 @@
+#include <functional>
+#include <thread>
+
+#include "parsearch.hpp"
+#include "predictor.hpp"
+
+/* xorshift64, only used to spread threads over queues */
+static inline uint64_t nextRandom(uint64_t &state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+ParallelSearch::ParallelSearch(EventId e1_, EventId e2_, CommonArg &arg_,
+                               std::vector<eid_t> &iset_, Option &opts_,
+                               VerdictBoard *board_, BudgetMeter &meter_,
+                               const StateEncoder &encoder_, VisitedSet &seen_,
+                               size_t numQueues)
+    : e1{e1_}, e2{e2_}, arg{arg_}, iset{iset_}, opts{opts_}, board{board_},
+      meter{meter_}, encoder{encoder_}, seen{seen_},
+      queues(std::max<size_t>(numQueues, 1)) {
+  self = board != nullptr ? board->indexOf(e1, e2) : 0;
+
+  maxDepth = Trace::maxDepth(iset);
+  uint64_t maxKey = maxStrategyKey(
+      opts.strategy, maxDepth, Trace::maxPriority(e1, e2, opts.weights));
+  for (Queue &q : queues)
+    q.nodes.reset(maxKey);
+}
+
+void ParallelSearch::seed(Frontier &frontier, uint64_t explored) {
+  nodes.store(explored, std::memory_order_relaxed);
+
+  for (size_t i = 0; !frontier.empty(); ++i) {
+    Queue &q = queues[i % queues.size()];
+    q.nodes.push(frontier.topKey(), frontier.top());
+    q.top.store(q.nodes.topKey(), std::memory_order_relaxed);
+    frontier.pop();
+    pending.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void ParallelSearch::push(std::shared_ptr<Trace> t, uint64_t &rng) {
+  pending.fetch_add(1, std::memory_order_acq_rel);
+
+  uint64_t key = strategyKey(opts.strategy, t->getDepth(), t->getPriority(),
+                             maxDepth);
+
+  Queue &q = queues[nextRandom(rng) % queues.size()];
+  std::lock_guard<std::mutex> lock{q.mutex};
+  q.nodes.push(key, std::move(t));
+  q.top.store(q.nodes.topKey(), std::memory_order_relaxed);
+}
+
+std::shared_ptr<Trace> ParallelSearch::pop(uint64_t &rng) {
+  auto take = [](Queue &q) -> std::shared_ptr<Trace> {
+    std::lock_guard<std::mutex> lock{q.mutex};
+    if (q.nodes.empty())
+      return nullptr;
+
+    std::shared_ptr<Trace> t = q.nodes.top();
+    q.nodes.pop();
+    q.top.store(q.nodes.empty() ? EMPTY : q.nodes.topKey(),
+                std::memory_order_relaxed);
+    return t;
+  };
+
+  // Take the better of two random queues
+  for (size_t attempt = 0; attempt < queues.size(); ++attempt) {
+    Queue &a = queues[nextRandom(rng) % queues.size()];
+    Queue &b = queues[nextRandom(rng) % queues.size()];
+    Queue &q = a.top.load(std::memory_order_relaxed) <=
+                       b.top.load(std::memory_order_relaxed)
+                   ? a
+                   : b;
+
+    if (q.top.load(std::memory_order_relaxed) == EMPTY)
+      continue;
+
+    if (std::shared_ptr<Trace> t = take(q))
+      return t;
+  }
+
+  // Most queues are empty, look through all of them
+  for (Queue &q : queues)
+    if (q.top.load(std::memory_order_relaxed) != EMPTY)
+      if (std::shared_ptr<Trace> t = take(q))
+        return t;
+
+  return nullptr;
+}
+
+bool ParallelSearch::visit(const std::shared_ptr<Trace> &t,
+                           std::vector<uint8_t> &key) {
+  size_t bytes = 0;
+  if (!seen.insert(*t, encoder, key, bytes))
+    return false;
+
+  meter.charge(bytes + t->memoryUsage());
+  return true;
+}
+
+bool ParallelSearch::finish(Verdict result) {
+  bool expected = false;
+  if (!done.compare_exchange_strong(expected, true, std::memory_order_acq_rel))
+    return false;
+
+  verdict.store(result, std::memory_order_release);
+  return true;
+}
+
+void ParallelSearch::work() {
+  workers.fetch_add(1, std::memory_order_acq_rel);
+
+  NodeArena *arena;
+  {
+    std::lock_guard<std::mutex> lock{arenasMutex};
+    arena = &arenas.emplace_back();
+  }
+  NodeArena::Scope scope{*arena};
+  uint64_t rng = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+  std::vector<uint8_t> key;
+
+  while (!isDone()) {
+    std::shared_ptr<Trace> reordering = pop(rng);
+
+    if (reordering == nullptr) {
+      // Nothing queued and nothing being expanded, the search is exhausted
+      if (pending.load(std::memory_order_acquire) == 0)
+        finish(NO_RACE);
+      else
+        std::this_thread::yield();
+      continue;
+    }
+
+    meter.release(reordering->memoryUsage());
+    if (meter.exceeded(nodes.fetch_add(1, std::memory_order_relaxed) + 1)) {
+      finish(UNKNOWN);
+      break;
+    }
+
+    // Decide other pairs witnessed here, stop if this pair has been decided
+    if (board != nullptr) {
+      board->harvest(*reordering, [&](size_t cop) {
+        if (opts.witness)
+          generateWitness(arg.events, reordering, board->getCOP(cop).first,
+                          board->getCOP(cop).second, opts);
+      });
+
+      if (self != board->size() && board->isDecided(self)) {
+        finish(RACE);
+        break;
+      }
+    }
+
+    if (reordering->isWitness(e1, e2)) {
+      if (finish(RACE) && opts.witness)
+        generateWitness(arg.events, reordering, e1, e2, opts);
+      break;
+    }
+
+    std::vector<EventId> executables =
+        reordering->getExecutableEvents(arg, iset, e1, e2);
+    std::vector<uint64_t> sleeps;
+    if (opts.por)
+      sleeps = reordering->reduce(arg, iset, executables, e1, e2);
+
+    for (size_t k = 0; k < executables.size(); ++k) {
+      std::shared_ptr<Trace> next = reordering->appendEvent(
+          arg, iset, encoder, opts.weights, executables[k], e1, e2);
+      if (opts.por)
+        next->setSleep(sleeps[k]);
+
+      if (visit(next, key)) {
+        if (opts.witness)
+          next->setPrev(reordering);
+        push(std::move(next), rng);
+      }
+    }
+
+    pending.fetch_sub(1, std::memory_order_acq_rel);
+  }
+
+  workers.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void ParallelSearch::waitForWorkers() const {
+  while (workers.load(std::memory_order_acquire) > 0)
+    std::this_thread::yield();
+}
+
+void ParallelSearch::clear() {
+  for (Queue &q : queues) {
+    std::lock_guard<std::mutex> lock{q.mutex};
+    q.nodes = NodeQueue{};
+    q.top.store(EMPTY, std::memory_order_relaxed);
+  }
+}
+
+std::pair<Verdict, uint32_t>
+SearchPool::search(EventId e1, EventId e2, CommonArg &arg,
+                   std::vector<eid_t> &iset, Option &opts, VerdictBoard *board,
+                   BudgetMeter &meter, const StateEncoder &encoder,
+                   VisitedSet &seen, Frontier &frontier, uint64_t explored) {
+  auto search = std::make_shared<ParallelSearch>(
+      e1, e2, arg, iset, opts, board, meter, encoder, seen, 2 * num_threads);
+  search->seed(frontier, explored);
+
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    searches.push_back(search);
+  }
+  changed.notify_all();
+
+  search->work();
+
+  {
+    std::lock_guard<std::mutex> lock{mutex};
+    std::erase(searches, search);
+  }
+
+  // Helpers may still be expanding nodes that point into this search
+  search->waitForWorkers();
+  search->clear();
+  return {search->getVerdict(), search->getNodes()};
+}
+
+std::shared_ptr<ParallelSearch> SearchPool::pick(size_t round) const {
+  for (size_t i = 0; i < searches.size(); ++i) {
+    auto &s = searches[(round + i) % searches.size()];
+    if (!s->isDone())
+      return s;
+  }
+
+  return nullptr;
+}
+
+void SearchPool::help(const std::atomic<size_t> &busy) {
+  idle.fetch_add(1, std::memory_order_relaxed);
+
+  for (size_t round = 0;; ++round) {
+    std::shared_ptr<ParallelSearch> search;
+    {
+      std::unique_lock<std::mutex> lock{mutex};
+      changed.wait(lock, [&]() {
+        search = pick(round);
+        return search != nullptr || busy.load(std::memory_order_acquire) == 0;
+      });
+    }
+
+    if (search == nullptr)
+      break;
+
+    search->work();
+  }
+
+  idle.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void SearchPool::wake() {
+  // Taking the mutex orders this after a helper's check of busy, so the
+  // helper is either waiting already or sees the new value
+  { std::lock_guard<std::mutex> lock{mutex}; }
+  changed.notify_all();
+}
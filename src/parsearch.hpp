@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "arena.hpp"
+#include "budget.hpp"
+#include "config.hpp"
+#include "event.hpp"
+#include "frontier.hpp"
+#include "preprocesser.hpp"
+#include "trace.hpp"
+#include "verdict.hpp"
+#include "visited.hpp"
+
+/* Number of nodes after which a search for a single COP accepts helpers */
+const uint64_t PARALLEL_SEARCH_NODES = 1 << 16;
+
+/* Number of nodes after which a search accepts helpers when workers are idle.
+ * Smaller searches end before sharing their frontier pays off. */
+const uint64_t IDLE_SEARCH_NODES = 1 << 12;
+
+/* Number of locked shards of the visited set of a search that may go
+ * parallel, per thread that may share it */
+const size_t VISITED_SHARDS_PER_THREAD = 4;
+
+/* Search for a single COP, shared by several threads.
+ *
+ * The frontier is a multi-queue: nodes are pushed to a random queue, and
+ * taken from the better of two random queues, so the order of the strategy is
+ * only approximated but threads rarely contend. The visited set is the one the
+ * sequential search started with. */
+class ParallelSearch {
+private:
+  static const uint64_t EMPTY = UINT64_MAX;
+
+  struct Queue {
+    std::mutex mutex;
+    NodeQueue nodes;
+    std::atomic<uint64_t> top{EMPTY}; // key of the best node
+  };
+
+  EventId e1, e2;
+  CommonArg &arg;
+  std::vector<eid_t> &iset;
+  Option &opts;
+  VerdictBoard *board;
+  size_t self;       // index of (e1, e2) on board
+  uint32_t maxDepth; // of the reorderings of iset, bounds their keys
+  BudgetMeter &meter;
+  const StateEncoder &encoder;
+  VisitedSet &seen;
+
+  // One per call of work(), as its nodes outlive it. Declared before queues,
+  // which must be cleared first.
+  std::mutex arenasMutex;
+  std::deque<NodeArena> arenas;
+
+  std::vector<Queue> queues;
+
+  std::atomic<uint64_t> nodes;
+  std::atomic<uint64_t> pending{0}; // nodes queued or being expanded
+  std::atomic<size_t> workers{0};
+  std::atomic<bool> done{false};
+  std::atomic<uint8_t> verdict{PENDING};
+
+  void push(std::shared_ptr<Trace> t, uint64_t &rng);
+  std::shared_ptr<Trace> pop(uint64_t &rng);
+
+  /* Adds t to the visited set, using key as scratch space. Returns false if
+   * it need not be expanded. */
+  bool visit(const std::shared_ptr<Trace> &t, std::vector<uint8_t> &key);
+
+  /* Ends the search, returns false if it had already ended */
+  bool finish(Verdict result);
+
+public:
+  ParallelSearch(EventId e1_, EventId e2_, CommonArg &arg_,
+                 std::vector<eid_t> &iset_, Option &opts_, VerdictBoard *board_,
+                 BudgetMeter &meter_, const StateEncoder &encoder_,
+                 VisitedSet &seen_, size_t numQueues);
+
+  ParallelSearch(const ParallelSearch &) = delete;
+  ParallelSearch &operator=(const ParallelSearch &) = delete;
+
+  /* Takes over the frontier of a sequential search */
+  void seed(Frontier &frontier, uint64_t explored);
+
+  /* Explores nodes until the search ends, may be called by several threads */
+  void work();
+
+  /* Blocks until no thread is in work() */
+  void waitForWorkers() const;
+
+  /* Drops the nodes left once the search is done and no thread is in
+   * work(), as some were allocated by the sequential search */
+  void clear();
+
+  bool isDone() const { return done.load(std::memory_order_acquire); }
+  Verdict getVerdict() const {
+    return static_cast<Verdict>(verdict.load(std::memory_order_acquire));
+  }
+  uint64_t getNodes() const { return nodes.load(std::memory_order_relaxed); }
+};
+
+/* Single COP searches that idle prediction workers can help with */
+class SearchPool {
+private:
+  size_t num_threads;
+  std::mutex mutex;
+  std::condition_variable changed; // a search was published, or busy is 0
+  std::vector<std::shared_ptr<ParallelSearch>> searches;
+  std::atomic<size_t> idle{0};
+
+  /* Returns a running search to help with, starting at searches[round], or
+   * nullptr if there is none. Requires mutex. */
+  std::shared_ptr<ParallelSearch> pick(size_t round) const;
+
+public:
+  explicit SearchPool(size_t num_threads_) : num_threads{num_threads_} {}
+
+  SearchPool(const SearchPool &) = delete;
+  SearchPool &operator=(const SearchPool &) = delete;
+
+  /* Number of shards for the visited set of a search that may go parallel */
+  size_t getShards() const { return VISITED_SHARDS_PER_THREAD * num_threads; }
+
+  /* Returns if a running search should switch to parallel mode, i.e. once it
+   * has explored many nodes, or some nodes when workers are idle because few
+   * COPs remain */
+  bool shouldShare(uint64_t explored) const {
+    return explored >= PARALLEL_SEARCH_NODES ||
+           (explored >= IDLE_SEARCH_NODES &&
+            idle.load(std::memory_order_relaxed) > 0);
+  }
+
+  /* Continues a sequential search in parallel, with the calling thread and
+   * any idle workers. seen should have getShards() shards. Returns the
+   * verdict for (e1, e2) and the nodes explored. */
+  std::pair<Verdict, uint32_t>
+  search(EventId e1, EventId e2, CommonArg &arg, std::vector<eid_t> &iset,
+         Option &opts, VerdictBoard *board, BudgetMeter &meter,
+         const StateEncoder &encoder, VisitedSet &seen, Frontier &frontier,
+         uint64_t explored);
+
+  /* Helps running searches until busy drops to zero, i.e. no worker is
+   * left that could still share a search. Waits for a search to be published
+   * or for wake() in between. */
+  void help(const std::atomic<size_t> &busy);
+
+  /* Wakes waiting helpers, to be called once busy has dropped to zero */
+  void wake();
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <array>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
@@ -6,9 +8,131 @@
 #include <utility>
 
 #include "errors.hpp"
+#include "mapped.hpp"
+#include "parallel.hpp"
 #include "parser.hpp"
+#include "tracefile.hpp"
 
-ParseResult parse(const std::string &filename) {
+/* Thread identifiers are 8 bits wide in the raw encoding */
+const size_t MAX_RAW_THREADS = 256;
+
+/* Decodes raw 64-bit events into per-thread vectors. A counting pass assigns
+ * tid_t in order of first appearance and sizes each thread's vector exactly
+ * once, the second pass fills them. */
+static ParseResult decode(const uint64_t *raw, size_t n) {
+  std::array<uint64_t, MAX_RAW_THREADS> counts{};
+  std::array<tid_t, MAX_RAW_THREADS> tids{};
+  std::unordered_map<uint32_t, tid_t>
+      thread_to_tid_map; // map of thread_id to tid (ensures tid is serial)
+
+  for (size_t i = 0; i < n; ++i) {
+    uint32_t thread = (raw[i] >> 52) & 0xFF;
+    if (counts[thread]++ == 0) {
+      tids[thread] = thread_to_tid_map.size();
+      thread_to_tid_map.emplace(thread, tids[thread]);
+    }
+  }
+
+  std::vector<std::vector<Event>> events(thread_to_tid_map.size());
+  for (auto [thread, tid] : thread_to_tid_map)
+    events[tid].reserve(counts[thread]);
+
+  for (size_t i = 0; i < n; ++i) {
+    Event e = Event{raw[i], static_cast<uint32_t>(i)};
+    tid_t tid = tids[e.getThreadId()];
+    e.setThreadId(tid); // overwrite existing thread id based on tid_t
+    events[tid].push_back(e);
+  }
+
+  return {std::move(events), std::move(thread_to_tid_map)};
+}
+
+/* Minimum number of events per chunk for decoding to be split across threads */
+const size_t MIN_CHUNK_EVENTS = 1 << 20;
+
+/* Decodes raw events in contiguous chunks on several threads.
+ *
+ * Each chunk first counts its events per raw thread id and records the order
+ * in which it first sees them. Chunks are then merged in input order, which
+ * reproduces the sequential first-seen tid_t assignment and gives every chunk
+ * a fixed slice of each thread's vector. The second pass scatters each chunk
+ * into its slices, so events stay ordered by getEventNum() within a thread. */
+static ParseResult decodePar(const uint64_t *raw, size_t n,
+                             size_t num_threads) {
+  size_t num_chunks = std::min(num_threads, n / MIN_CHUNK_EVENTS);
+  if (num_chunks <= 1)
+    return decode(raw, n);
+
+  struct Chunk {
+    size_t begin;
+    size_t end;
+    std::array<uint64_t, MAX_RAW_THREADS> counts{};
+    std::vector<uint32_t> order; // raw thread ids in order of first appearance
+  };
+
+  std::vector<Chunk> chunks(num_chunks);
+  size_t per_chunk = n / num_chunks;
+  for (size_t c = 0; c < num_chunks; ++c) {
+    chunks[c].begin = c * per_chunk;
+    chunks[c].end = c + 1 == num_chunks ? n : (c + 1) * per_chunk;
+  }
+
+  // 1. Count events per thread in each chunk
+  runParallel(num_chunks, [&](size_t c) {
+    Chunk &chunk = chunks[c];
+    for (size_t i = chunk.begin; i < chunk.end; ++i) {
+      uint32_t thread = (raw[i] >> 52) & 0xFF;
+      if (chunk.counts[thread]++ == 0)
+        chunk.order.push_back(thread);
+    }
+  });
+
+  // 2. Merge chunks in order: assign tid_t and per-chunk write offsets
+  std::array<uint64_t, MAX_RAW_THREADS> counts{};
+  std::array<tid_t, MAX_RAW_THREADS> tids{};
+  std::vector<std::array<uint64_t, MAX_RAW_THREADS>> offsets(num_chunks);
+  std::unordered_map<uint32_t, tid_t> thread_to_tid_map;
+
+  for (size_t c = 0; c < num_chunks; ++c) {
+    for (auto thread : chunks[c].order)
+      if (counts[thread] == 0) {
+        tids[thread] = thread_to_tid_map.size();
+        thread_to_tid_map.emplace(thread, tids[thread]);
+      }
+
+    for (size_t thread = 0; thread < MAX_RAW_THREADS; ++thread) {
+      offsets[c][thread] = counts[thread];
+      counts[thread] += chunks[c].counts[thread];
+    }
+  }
+
+  std::vector<std::vector<Event>> events(thread_to_tid_map.size());
+  std::vector<std::pair<uint32_t, tid_t>> threads(thread_to_tid_map.begin(),
+                                                  thread_to_tid_map.end());
+  runParallel(num_chunks, [&](size_t c) {
+    for (size_t i = c; i < threads.size(); i += num_chunks)
+      events[threads[i].second].resize(counts[threads[i].first]);
+  });
+
+  // 3. Scatter each chunk into its slice of the per-thread vectors
+  runParallel(num_chunks, [&](size_t c) {
+    std::array<uint64_t, MAX_RAW_THREADS> &next = offsets[c];
+    for (size_t i = chunks[c].begin; i < chunks[c].end; ++i) {
+      Event e = Event{raw[i], static_cast<uint32_t>(i)};
+      uint32_t thread = e.getThreadId();
+      tid_t tid = tids[thread];
+      e.setThreadId(tid);
+      events[tid][next[thread]++] = e;
+    }
+  });
+
+  return {std::move(events), std::move(thread_to_tid_map)};
+}
+
+/* Reads an unmappable input (e.g. a pipe) in bulk. The buffer is padded to a
+ * whole number of events, size is set to the number of bytes read. */
+static std::vector<uint64_t> readStream(const std::string &filename,
+                                        size_t &size) {
   std::ifstream file{filename, std::ios::binary};
 
   if (!file.is_open()) {
@@ -16,41 +140,48 @@ ParseResult parse(const std::string &filename) {
     throw std::runtime_error{"Failed to open file" + filename};
   }
 
-  std::vector<std::vector<Event>> events;
-  std::unordered_map<uint32_t, tid_t>
-      thread_to_tid_map; // map of thread_id to tid (ensures tid is serial)
+  const size_t CHUNK = 1 << 16;
+  std::vector<uint64_t> raw;
+  size = 0;
 
-  uint32_t i = 0;
   while (true) {
-    uint64_t rawEvent = 0;
+    raw.resize(size / sizeof(uint64_t) + 1 + CHUNK);
+    file.read(reinterpret_cast<char *>(raw.data()) + size,
+              CHUNK * sizeof(uint64_t));
+    size += file.gcount();
 
-    file.read(reinterpret_cast<char *>(&rawEvent), sizeof(rawEvent));
     if (file.eof())
       break;
 
-    if (file.fail()) {
-      throw EncodingError{i, rawEvent};
-    }
+    if (file.fail())
+      throw EncodingError{static_cast<uint32_t>(size / sizeof(uint64_t)),
+                          raw[size / sizeof(uint64_t)]};
+  }
 
-    // Parsing logic here
-    Event e = Event{rawEvent, i++};
-    // std::cout << "Event: " << e << std::endl;
+  raw.resize((size + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+  return raw;
+}
 
-    auto [it, isInserted] = thread_to_tid_map.try_emplace(
-        e.getThreadId(), thread_to_tid_map.size());
-    if (isInserted)
-      events.push_back(std::vector<Event>());
+/* Decodes either format from an in-memory buffer. Trailing bytes of a raw
+ * trace that do not form a full event are ignored. */
+static ParseResult decodeBuffer(const void *data, size_t size,
+                                size_t num_threads) {
+  if (isCompressedTrace(data, size))
+    return readCompressedTrace(data, size, num_threads);
 
-    tid_t tid = it->second;
-    e.setThreadId(tid); // overwrite existing thread id based on tid_t
-    events[tid].push_back(e);
-  }
+  // Buffers are page or allocator aligned, records can be read in place
+  return decodePar(static_cast<const uint64_t *>(data),
+                   size / sizeof(uint64_t), num_threads);
+}
 
-  file.close();
+ParseResult parse(const std::string &filename, size_t num_threads) {
+  MappedFile file{filename};
 
-  // for (auto p : thread_to_tid_map) {
-  //   std::cout << p.first << ", " << p.second << std::endl;
-  // }
+  if (!file.isMapped()) {
+    size_t size;
+    std::vector<uint64_t> raw = readStream(filename, size);
+    return decodeBuffer(raw.data(), size, num_threads);
+  }
 
-  return {events, thread_to_tid_map};
+  return decodeBuffer(file.data(), file.size(), num_threads);
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "event.hpp"
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 struct ParseResult {
@@ -13,5 +15,6 @@ struct ParseResult {
   std::unordered_map<uint32_t, tid_t> thread_to_tid_map;
 };
 
-/* Parses input trace from given path */
-ParseResult parse(const std::string &filename);
+/* Parses input trace from given path. Large traces are decoded on up to
+ * num_threads threads. */
+ParseResult parse(const std::string &filename, size_t num_threads = 1);
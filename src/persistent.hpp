@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "arena.hpp"
+
+/*
+** Containers whose copies share storage. A copy is cheap and a write only
+** copies the parts of the container it touches, so that a successor of a
+** search node shares almost all of its state with the node.
+**
+** A part is written in place when the container holding it is its only
+** owner, e.g. when a node is written to several times after being copied.
+** Parts are allocated from the current NodeArena, if any.
+*/
+
+/* Fixed size array, stored as chunks of CHUNK_SIZE elements. Copying costs a
+ * pointer per chunk and a write copies at most one chunk. Pointers to the
+ * first INLINE_CHUNKS chunks are kept in the array itself, so small arrays
+ * are copied without allocating. */
+template <typename T, size_t CHUNK_SIZE = 16, size_t INLINE_CHUNKS = 4>
+class PersistentArray {
+private:
+  typedef std::array<T, CHUNK_SIZE> Chunk;
+
+  std::array<std::shared_ptr<Chunk>, INLINE_CHUNKS> head;
+  std::vector<std::shared_ptr<Chunk>, ArenaAllocator<std::shared_ptr<Chunk>>>
+      tail;
+  size_t length = 0;
+
+  size_t numChunks() const { return (length + CHUNK_SIZE - 1) / CHUNK_SIZE; }
+
+  const std::shared_ptr<Chunk> &chunk(size_t c) const {
+    return c < INLINE_CHUNKS ? head[c] : tail[c - INLINE_CHUNKS];
+  }
+
+  std::shared_ptr<Chunk> &chunk(size_t c) {
+    return c < INLINE_CHUNKS ? head[c] : tail[c - INLINE_CHUNKS];
+  }
+
+public:
+  PersistentArray() = default;
+
+  PersistentArray(size_t n, const T &value) : length{n} {
+    // Every chunk starts out as the same chunk
+    std::shared_ptr<Chunk> init = makeNode<Chunk>();
+    init->fill(value);
+
+    if (numChunks() > INLINE_CHUNKS)
+      tail.resize(numChunks() - INLINE_CHUNKS);
+    for (size_t c = 0; c < numChunks(); ++c)
+      chunk(c) = init;
+  }
+
+  size_t size() const { return length; }
+
+  const T &operator[](size_t i) const {
+    return (*chunk(i / CHUNK_SIZE))[i % CHUNK_SIZE];
+  }
+
+  /* Sets element i to value, copying its chunk first if it is shared */
+  void set(size_t i, const T &value) {
+    std::shared_ptr<Chunk> &c = chunk(i / CHUNK_SIZE);
+    if (c.use_count() != 1)
+      c = makeNode<Chunk>(*c);
+    (*c)[i % CHUNK_SIZE] = value;
+  }
+
+  /* Returns an estimate of the bytes not shared with other arrays, besides
+   * the array itself */
+  size_t ownedBytes() const {
+    size_t bytes = tail.capacity() * sizeof(std::shared_ptr<Chunk>);
+    for (size_t c = 0; c < numChunks(); ++c)
+      if (chunk(c).use_count() == 1)
+        bytes += sizeof(Chunk) + 2 * sizeof(void *);
+    return bytes;
+  }
+
+  bool operator==(const PersistentArray &other) const {
+    if (length != other.length)
+      return false;
+
+    for (size_t c = 0; c < numChunks(); ++c) {
+      if (chunk(c) == other.chunk(c))
+        continue;
+
+      size_t end = std::min(CHUNK_SIZE, length - c * CHUNK_SIZE);
+      for (size_t i = 0; i < end; ++i)
+        if ((*chunk(c))[i] != (*other.chunk(c))[i])
+          return false;
+    }
+
+    return true;
+  }
+};
+
+/* Map from 32 bit keys to values, stored as a trie on the bits of the key,
+ * BITS at a time from the most significant. A node only stores its present
+ * slots, in order, marked by a bitmap. Writes and erases copy the path from
+ * the root to the key, i.e. at most 7 nodes.
+ *
+ * The trie is only as high as its largest key requires, so maps with the same
+ * entries have the same shape and are compared node by node. */
+template <typename V> class PersistentMap {
+private:
+  static const uint32_t BITS = 5;
+  static const uint32_t MASK = (1 << BITS) - 1;
+
+  struct Node {
+    uint32_t bitmap = 0;
+    std::vector<V, ArenaAllocator<V>> values; // bottom level only
+    std::vector<std::shared_ptr<Node>, ArenaAllocator<std::shared_ptr<Node>>>
+        children; // other levels
+
+    bool has(uint32_t bit) const { return (bitmap >> bit) & 1; }
+
+    /* Position of slot bit among the present slots */
+    size_t slot(uint32_t bit) const {
+      return std::popcount(bitmap & ((1u << bit) - 1));
+    }
+  };
+
+  std::shared_ptr<Node> root;
+  uint32_t shift = 0; // bits of the key below the root's slot
+  size_t count = 0;
+
+  bool covers(uint32_t key) const {
+    return shift + BITS >= 32 || (key >> (shift + BITS)) == 0;
+  }
+
+  /* Makes p the only owner of its node, returns the node */
+  static Node *own(std::shared_ptr<Node> &p) {
+    if (p.use_count() != 1)
+      p = makeNode<Node>(*p);
+    return p.get();
+  }
+
+  static void erase(std::shared_ptr<Node> &p, uint32_t s, uint32_t key) {
+    Node *n = own(p);
+    uint32_t bit = (key >> s) & MASK;
+    size_t idx = n->slot(bit);
+
+    if (s == 0) {
+      n->values.erase(n->values.begin() + idx);
+    } else {
+      erase(n->children[idx], s - BITS, key);
+      if (n->children[idx]->bitmap != 0)
+        return;
+      n->children.erase(n->children.begin() + idx);
+    }
+
+    n->bitmap &= ~(1u << bit);
+  }
+
+  static bool equal(const Node *a, const Node *b, uint32_t s) {
+    if (a == b)
+      return true;
+
+    if (a->bitmap != b->bitmap)
+      return false;
+
+    if (s == 0)
+      return a->values == b->values;
+
+    for (size_t i = 0; i < a->children.size(); ++i)
+      if (!equal(a->children[i].get(), b->children[i].get(), s - BITS))
+        return false;
+
+    return true;
+  }
+
+  template <typename F>
+  static void forEach(const Node *n, uint32_t s, uint32_t prefix, F &f) {
+    for (uint32_t bit = 0, idx = 0; bit <= MASK; ++bit) {
+      if (!n->has(bit))
+        continue;
+
+      uint32_t key = (prefix << BITS) | bit;
+      if (s == 0)
+        f(key, n->values[idx]);
+      else
+        forEach(n->children[idx].get(), s - BITS, key, f);
+      ++idx;
+    }
+  }
+
+  static size_t ownedBytes(const std::shared_ptr<Node> &p) {
+    if (p.use_count() != 1)
+      return 0;
+
+    size_t bytes = sizeof(Node) + 2 * sizeof(void *) +
+                   p->values.capacity() * sizeof(V) +
+                   p->children.capacity() * sizeof(std::shared_ptr<Node>);
+    for (const auto &child : p->children)
+      bytes += ownedBytes(child);
+    return bytes;
+  }
+
+public:
+  size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  /* Returns the value of key, nullptr if key is not in the map */
+  const V *find(uint32_t key) const {
+    if (root == nullptr || !covers(key))
+      return nullptr;
+
+    const Node *n = root.get();
+    for (uint32_t s = shift;; s -= BITS) {
+      uint32_t bit = (key >> s) & MASK;
+      if (!n->has(bit))
+        return nullptr;
+
+      if (s == 0)
+        return &n->values[n->slot(bit)];
+      n = n->children[n->slot(bit)].get();
+    }
+  }
+
+  bool contains(uint32_t key) const { return find(key) != nullptr; }
+
+  void set(uint32_t key, const V &value) {
+    if (root == nullptr) {
+      root = makeNode<Node>();
+      for (shift = 0; !covers(key); shift += BITS)
+        ;
+    }
+
+    while (!covers(key)) {
+      std::shared_ptr<Node> parent = makeNode<Node>();
+      parent->bitmap = 1;
+      parent->children.push_back(std::move(root));
+      root = std::move(parent);
+      shift += BITS;
+    }
+
+    Node *n = own(root);
+    for (uint32_t s = shift;; s -= BITS) {
+      uint32_t bit = (key >> s) & MASK;
+      size_t idx = n->slot(bit);
+
+      if (s == 0) {
+        if (n->has(bit)) {
+          n->values[idx] = value;
+        } else {
+          n->values.insert(n->values.begin() + idx, value);
+          n->bitmap |= 1u << bit;
+          ++count;
+        }
+        return;
+      }
+
+      if (!n->has(bit)) {
+        n->children.insert(n->children.begin() + idx, makeNode<Node>());
+        n->bitmap |= 1u << bit;
+      }
+      n = own(n->children[idx]);
+    }
+  }
+
+  void erase(uint32_t key) {
+    if (!contains(key))
+      return;
+
+    erase(root, shift, key);
+    --count;
+
+    // Keep the trie as low as its largest key requires
+    while (shift > 0 && root->bitmap == 1) {
+      std::shared_ptr<Node> child = root->children.front();
+      root = std::move(child);
+      shift -= BITS;
+    }
+
+    if (count == 0) {
+      root = nullptr;
+      shift = 0;
+    }
+  }
+
+  /* Calls f(key, value) for every entry, in order of key */
+  template <typename F> void forEach(F f) const {
+    if (root != nullptr)
+      forEach(root.get(), shift, 0, f);
+  }
+
+  /* Returns an estimate of the bytes not shared with other maps */
+  size_t ownedBytes() const { return root == nullptr ? 0 : ownedBytes(root); }
+
+  bool operator==(const PersistentMap &other) const {
+    if (count != other.count || shift != other.shift)
+      return false;
+
+    return count == 0 || equal(root.get(), other.root.get(), shift);
+  }
+};
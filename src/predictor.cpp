@@ -1,67 +1,198 @@
 #include "predictor.hpp"
+#include "arena.hpp"
 #include "config.hpp"
+#include "context.hpp"
 #include "event.hpp"
 #include "iset.hpp"
 #include "trace.hpp"
+#include <array>
+#include <exception>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <numeric>
 #include <queue>
+#include <thread>
 #include <vector>
 
-std::pair<bool, uint32_t> isDataRace(EventId e1, EventId e2, CommonArg &arg,
-                                     Option &opts) {
+std::pair<Verdict, uint32_t> isDataRace(EventId e1, EventId e2,
+                                        CommonArg &arg, Option &opts,
+                                        VerdictBoard *board, SearchPool *pool,
+                                        SearchContext *ctx) {
   std::vector<eid_t> includeSet = getIncludeSet(e1, e2, arg.events, arg);
-  return verifySC(e1, e2, arg, includeSet, opts);
+  return verifySC(e1, e2, arg, includeSet, opts, board, pool, ctx);
 }
 
-std::pair<bool, uint32_t> verifySC(EventId e1, EventId e2, CommonArg &arg,
-                                   std::vector<eid_t> &includeSet,
-                                   Option &opt) {
-  size_t totalSize =
-      std::accumulate(arg.events.begin(), arg.events.end(), 0,
-                      [](size_t sum, const std::vector<Event> &thread) {
-                        return sum + thread.size();
-                      });
+/* Searches for a witness of (e1, e2) in the order of opt.strategy, with the
+ * frontier and visited set of ctx, charging the search to meter */
+static std::pair<Verdict, uint32_t>
+explore(EventId e1, EventId e2, CommonArg &arg, std::vector<eid_t> &includeSet,
+        Option &opt, VerdictBoard *board, SearchPool *pool, BudgetMeter &meter,
+        SearchContext &ctx) {
   uint64_t i = 1; // Track number of nodes explored
+  size_t self = board != nullptr ? board->indexOf(e1, e2) : 0;
 
-  std::unordered_set<std::shared_ptr<Trace>> seen(totalSize);
-  std::priority_queue<std::shared_ptr<Trace>,
-                      std::vector<std::shared_ptr<Trace>>, TracePtrCmp>
-      pq;
+  // States are only kept as encodings, sharded if the search may go parallel
+  const StateEncoder &encoder = ctx.getEncoder();
+  VisitedSet &seen = ctx.getSeen();
+  std::vector<uint8_t> &key = ctx.getKey();
+  size_t bytes = 0;
+  Frontier &pq = ctx.getFrontier();
 
   // 1. Initialize empty trace
-  std::shared_ptr<Trace> init = std::make_shared<Trace>(arg, includeSet);
-  pq.push(init);
+  std::shared_ptr<Trace> init = makeNode<Trace>(arg, includeSet);
+  seen.insert(*init, encoder, key, bytes);
+  meter.charge(bytes + init->memoryUsage());
+  pq.push(std::move(init));
 
   while (!pq.empty()) {
+    if (meter.exceeded(i))
+      return {UNKNOWN, i};
+
+    // Continue on several threads once the search is large or workers idle
+    if (pool != nullptr && pq.isShareable() && pool->shouldShare(i))
+      return pool->search(e1, e2, arg, includeSet, opt, board, meter, encoder,
+                          seen, pq, i);
+
     std::shared_ptr<Trace> reordering = pq.top();
     pq.pop();
+    meter.release(reordering->memoryUsage());
+
+    // Beam searches drop what lies beyond their width
+    if (pq.prune(*reordering))
+      continue;
     ++i;
 
-    // 2. Check curr reordering is witness
+    // 2. Decide other pairs witnessed by curr reordering, stop if this pair
+    // has been decided here or by another search
+    if (board != nullptr) {
+      board->harvest(*reordering, [&](size_t cop) {
+        if (opt.witness)
+          generateWitness(arg.events, reordering, board->getCOP(cop).first,
+                          board->getCOP(cop).second, opt);
+      });
+
+      if (self != board->size() && board->isDecided(self))
+        return {RACE, i};
+    }
+
+    // 3. Check curr reordering is witness
     if (reordering->isWitness(e1, e2)) {
       if (opt.witness) {
         generateWitness(arg.events, reordering, e1, e2, opt);
       }
-      return {true, i};
+      return {RACE, i};
     }
 
-    // 3. Execute all executable events
-    for (auto i : reordering->getExecutableEvents(arg, includeSet, e1, e2)) {
-      std::shared_ptr<Trace> nextReordering =
-          reordering->appendEvent(arg, includeSet, i, e1, e2);
+    // 4. Execute all executable events, except those asleep with --por
+    std::vector<EventId> executables =
+        reordering->getExecutableEvents(arg, includeSet, e1, e2);
+    std::vector<uint64_t> sleeps;
+    if (opt.por)
+      sleeps = reordering->reduce(arg, includeSet, executables, e1, e2);
+
+    for (size_t k = 0; k < executables.size(); ++k) {
+      std::shared_ptr<Trace> nextReordering = reordering->appendEvent(
+          arg, includeSet, encoder, opt.weights, executables[k], e1, e2);
+      if (opt.por)
+        nextReordering->setSleep(sleeps[k]);
 
-      if (seen.find(nextReordering) == seen.end()) {
-        pq.push(nextReordering);
-        seen.insert(nextReordering);
+      if (seen.insert(*nextReordering, encoder, key, bytes)) {
+        if (opt.witness)
+          nextReordering->setPrev(reordering);
+        meter.charge(bytes + nextReordering->memoryUsage());
+        pq.push(std::move(nextReordering));
       }
     }
   }
 
-  return {false, i};
+  return {pq.isPruned() ? UNKNOWN : NO_RACE, i};
+}
+
+/* Runs explore with ctx reset for (e1, e2) */
+static std::pair<Verdict, uint32_t>
+search(EventId e1, EventId e2, CommonArg &arg, std::vector<eid_t> &includeSet,
+       Option &opt, VerdictBoard *board, SearchPool *pool, BudgetMeter &meter,
+       SearchContext &ctx) {
+  // Nodes live in the arena of this thread, which is reset in one go once
+  // they are all gone
+  NodeArena::Scope arena{NodeArena::local(), true};
+
+  ctx.reset(arg, includeSet, e1, e2, opt, opt.strategy,
+            pool != nullptr ? pool->getShards() : 1);
+
+  // Drops the nodes left in ctx before the arena is reset, also if explore
+  // throws
+  struct Release {
+    SearchContext &ctx;
+    ~Release() { ctx.release(); }
+  } release{ctx};
+
+  return explore(e1, e2, arg, includeSet, opt, board, pool, meter, ctx);
+}
+
+/* Runs the two strategies of opt.portfolio on (e1, e2) at once. The first to
+ * decide the pair stops the other one. */
+static std::pair<Verdict, uint32_t>
+racePortfolio(EventId e1, EventId e2, CommonArg &arg,
+              std::vector<eid_t> &includeSet, Option &opt, VerdictBoard *board,
+              SearchPool *pool, SearchContext &ctx) {
+  std::array<Option, 2> racers{opt, opt};
+  racers[0].strategy = opt.portfolio->first;
+  racers[1].strategy = opt.portfolio->second;
+
+  BudgetMeter first{opt.budget}, second{opt.budget};
+  std::array<BudgetMeter *, 2> meters{&first, &second};
+  std::array<SearchContext *, 2> contexts{&ctx, &ctx.getPartner()};
+  std::array<std::pair<Verdict, uint32_t>, 2> results;
+
+  auto race = [&](size_t k) {
+    results[k] = search(e1, e2, arg, includeSet, racers[k], board, pool,
+                        *meters[k], *contexts[k]);
+    if (results[k].first != UNKNOWN)
+      meters[1 - k]->cancel();
+  };
+
+  HelperThread &other = ctx.getPartnerThread();
+  other.start([&]() { race(1); });
+  {
+    // The partner uses the locals above, so it must be done before they go,
+    // also if race(0) throws. It is then stopped rather than waited out.
+    struct Join {
+      HelperThread &other;
+      BudgetMeter &meter;
+      ~Join() {
+        if (std::uncaught_exceptions() > 0)
+          meter.cancel();
+        other.waitIdle();
+      }
+    } join{other, second};
+
+    race(0);
+  }
+  other.wait();
+
+  Verdict verdict =
+      results[0].first != UNKNOWN ? results[0].first : results[1].first;
+  return {verdict, results[0].second + results[1].second};
+}
+
+std::pair<Verdict, uint32_t> verifySC(EventId e1, EventId e2, CommonArg &arg,
+                                      std::vector<eid_t> &includeSet,
+                                      Option &opt, VerdictBoard *board,
+                                      SearchPool *pool, SearchContext *ctx) {
+  std::unique_ptr<SearchContext> own;
+  if (ctx == nullptr) {
+    own = std::make_unique<SearchContext>();
+    ctx = own.get();
+  }
+
+  if (opt.portfolio.has_value())
+    return racePortfolio(e1, e2, arg, includeSet, opt, board, pool, *ctx);
+
+  BudgetMeter meter{opt.budget};
+  return search(e1, e2, arg, includeSet, opt, board, pool, meter, *ctx);
 }
 
 /* Generate and writes witness to output file dir */
@@ -70,7 +201,12 @@ void generateWitness(std::vector<std::vector<Event>> &events,
                      Option &opts) {
   std::vector<Event> witness = t->getWitness(events);
   // std::cout << "Witness received, now writing..." << std::endl;
+  writeWitness(events, witness, e1, e2, opts);
+}
 
+void writeWitness(std::vector<std::vector<Event>> &events,
+                  const std::vector<Event> &witness, EventId e1, EventId e2,
+                  Option &opts) {
   // Construct output file name
   Event event1 = getEvent(events, e1);
   Event event2 = getEvent(events, e2);
@@ -88,8 +224,14 @@ void generateWitness(std::vector<std::vector<Event>> &events,
   std::filesystem::path outputFilePath =
       std::filesystem::path(outputDir) / filename;
 
-  // std::ofstream outputFile(outputFilePath, std::ios::binary);
-  std::ofstream outputFile{outputFilePath};
+  // Write to a file of this thread first, searches racing on a COP may both
+  // find a witness for it
+  std::filesystem::path tmpFilePath = outputFilePath;
+  tmpFilePath += ".tmp" + std::to_string(std::hash<std::thread::id>{}(
+                              std::this_thread::get_id()));
+
+  // std::ofstream outputFile(tmpFilePath, std::ios::binary);
+  std::ofstream outputFile{tmpFilePath};
 
   if (!outputFile.is_open()) {
     std::cerr << "Error opening file to generate witness" << std::endl;
@@ -110,6 +252,7 @@ void generateWitness(std::vector<std::vector<Event>> &events,
   }
 
   outputFile.close();
+  std::filesystem::rename(tmpFilePath, outputFilePath);
 }
 
 std::vector<Event>
@@ -126,7 +269,7 @@ Trace::getWitness(std::vector<std::vector<Event>> &allEvents) {
       }
     }
 
-    curr = curr->prev;
+    curr = curr->prev.get();
   }
 
   return witness;
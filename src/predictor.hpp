@@ -1,14 +1,21 @@
 #pragma once
 
+#include "cache.hpp"
 #include "config.hpp"
+#include "context.hpp"
 #include "event.hpp"
 #include "parser.hpp"
+#include "parsearch.hpp"
 #include "preprocesser.hpp"
+#include "scheduler.hpp"
+#include "syncp.hpp"
 #include "trace.hpp"
+#include "verdict.hpp"
 #include <atomic>
 #include <chrono>
 #include <format>
 #include <memory>
+#include <numeric>
 #include <ratio>
 #include <thread>
 #include <unordered_map>
@@ -18,20 +25,39 @@
 ** Functions for data race prediction
 */
 
-/* Returns if a given pair is a data race, and the number of nodes explored */
-std::pair<bool, uint32_t> verifySC(EventId e1, EventId e2, CommonArg &arg,
-                                   std::vector<eid_t> &includeSet,
-                                   Option &opts);
+/* Returns if a given pair is a data race, and the number of nodes explored.
+ * Reorderings are expanded in the order of opts.strategy, or of both
+ * strategies of opts.portfolio at once. The verdict is UNKNOWN if the search
+ * exceeds opts.budget or a beam search dropped reorderings. If a board is
+ * given, every explored state also decides the other pending
+ * COPs it witnesses, and the search stops once (e1, e2) has been decided by
+ * another search. If a pool is given, the search continues on several
+ * threads once it grows large or other workers are idle. If a context is
+ * given, the search reuses its memory rather than allocating its own. */
+std::pair<Verdict, uint32_t> verifySC(EventId e1, EventId e2, CommonArg &arg,
+                                      std::vector<eid_t> &includeSet,
+                                      Option &opts,
+                                      VerdictBoard *board = nullptr,
+                                      SearchPool *pool = nullptr,
+                                      SearchContext *ctx = nullptr);
 
 /* Wrapper function - generates an IncludeSet for e1, e2 before calling verifySC
  */
-std::pair<bool, uint32_t> isDataRace(EventId e1, EventId e2, CommonArg &arg,
-                                     Option &opts);
+std::pair<Verdict, uint32_t> isDataRace(EventId e1, EventId e2,
+                                        CommonArg &arg, Option &opts,
+                                        VerdictBoard *board = nullptr,
+                                        SearchPool *pool = nullptr,
+                                        SearchContext *ctx = nullptr);
 
 void generateWitness(std::vector<std::vector<Event>> &events,
                      std::shared_ptr<Trace> t, EventId e1, EventId e2,
                      Option &opts);
 
+/* Writes the events of witness, latest first, as the witness of (e1, e2) */
+void writeWitness(std::vector<std::vector<Event>> &events,
+                  const std::vector<Event> &witness, EventId e1, EventId e2,
+                  Option &opts);
+
 /* Returns num_thread to concurrently execute race prediction */
 inline size_t getNumThreads(std::vector<std::pair<EventId, EventId>> &cops,
                             Option &opts) {
@@ -55,26 +81,58 @@ inline size_t getNumThreads(std::vector<std::pair<EventId, EventId>> &cops,
 class Predictor {
 private:
   std::vector<std::pair<EventId, EventId>> races;
+  std::vector<std::pair<EventId, EventId>> unknowns; // out of budget
   std::vector<std::vector<Event>> events;
   std::unordered_map<uint32_t, tid_t> thread_to_tid_map;
   Option opts;
 
-  void predictPar(CommonArg &arg,
-                  std::vector<std::pair<EventId, EventId>> &cops,
-                  Option &opts) {
-    std::mutex race_mutex;
+  /* Decides the COPs at indices on board, using opts.budget per COP */
+  void runPass(CommonArg &arg, std::vector<std::pair<EventId, EventId>> &cops,
+               const std::vector<size_t> &indices, VerdictBoard &board,
+               Option &opts) {
     std::mutex io_mutex; // Mutex for ensuring serial output to cout
-    std::atomic<size_t> idx{0};
+    std::atomic<size_t> skipped{0};
+
+    std::vector<std::pair<EventId, EventId>> pass;
+    for (size_t i : indices)
+      pass.push_back(cops[i]);
 
     std::vector<std::thread> workers;
-    size_t num_threads = getNumThreads(cops, opts);
+    size_t num_threads = getNumThreads(pass, opts);
+    // Only the costs are kept, each include set is built again by the worker
+    // that verifies its COP
+    Scheduler scheduler{estimateCosts(pass, arg, num_threads), num_threads};
+    // A single worker has no one to share a search with
+    std::unique_ptr<SearchPool> pool;
+    if (num_threads > 1)
+      pool = std::make_unique<SearchPool>(num_threads);
+    // Workers that still have pairs, and so may still share a search
+    std::atomic<size_t> busy{num_threads};
+
+    auto worker = [&](size_t id) {
+      SearchContext ctx;
 
-    auto worker = [&]() {
       while (true) {
-        size_t i = idx.fetch_add(1, std::memory_order_relaxed);
+        std::optional<size_t> next = scheduler.next(id);
+
+        if (!next.has_value()) {
+          // Out of pairs, help with the searches still running. The last
+          // worker to run out wakes the helpers waiting for one.
+          if (pool != nullptr) {
+            if (busy.fetch_sub(1, std::memory_order_acq_rel) == 1)
+              pool->wake();
+            pool->help(busy);
+          }
+          return;
+        }
 
-        if (i >= cops.size())
-          return; // Stop if out of bounds
+        size_t i = indices[next.value()];
+
+        // Already witnessed while searching for another pair
+        if (board.isDecided(i)) {
+          skipped.fetch_add(1, std::memory_order_relaxed);
+          continue;
+        }
 
         std::chrono::time_point<
             std::chrono::steady_clock,
@@ -84,13 +142,11 @@ private:
         if (opts.verbose)
           start = std::chrono::high_resolution_clock::now();
 
-        auto [isRace, nodesExplored] =
-            isDataRace(cops[i].first, cops[i].second, arg, opts);
-
-        if (isRace) {
-          std::lock_guard<std::mutex> lock{race_mutex};
-          races.push_back(cops[i]);
-        }
+        // Searches only see the board if they may decide other pairs
+        auto [verdict, nodesExplored] = isDataRace(
+            cops[i].first, cops[i].second, arg, opts,
+            opts.harvest ? &board : nullptr, pool.get(), &ctx);
+        board.decide(i, verdict);
 
         if (opts.verbose) {
           auto duration =
@@ -98,9 +154,10 @@ private:
                   std::chrono::high_resolution_clock::now() - start) /
               1000.0;
           std::string msg = std::format(
-              "Pair {}\nNodes explored: {}\nTime taken ({}, {}): {}\n\n", i,
+              "Pair {}\nNodes explored: {}\nTime taken ({}, {}): {}\n{}\n", i,
               nodesExplored, getEvent(events, cops[i].first).getEventNum(),
-              getEvent(events, cops[i].second).getEventNum(), duration.count());
+              getEvent(events, cops[i].second).getEventNum(), duration.count(),
+              verdict == UNKNOWN ? "Out of budget\n" : "");
 
           std::lock_guard<std::mutex> lock{io_mutex};
           std::cout << msg;
@@ -109,12 +166,94 @@ private:
     };
 
     for (size_t i = 0; i < num_threads; ++i) {
-      workers.emplace_back(worker);
+      workers.emplace_back(worker, i);
     }
 
     for (auto &t : workers) {
       t.join();
     }
+
+    if (opts.verbose && opts.harvest)
+      std::cout << "Pairs decided during other searches: " << skipped.load()
+                << std::endl;
+  }
+
+  /* Decides the COPs that are sync-preserving races on board, returns the
+   * indices of the others. Confirmed COPs are never searched, so with
+   * opts.harvest the races only their searches would witness are lost. */
+  std::vector<size_t>
+  confirmSyncPreserving(CommonArg &arg,
+                        std::vector<std::pair<EventId, EventId>> &cops,
+                        VerdictBoard &board, Option &opts) {
+    SyncPreserving syncp{arg};
+    std::atomic<size_t> next{0};
+
+    auto worker = [&]() {
+      std::vector<Event> witness;
+      for (size_t i = next++; i < cops.size(); i = next++) {
+        if (!syncp.isRace(cops[i].first, cops[i].second,
+                          opts.witness ? &witness : nullptr))
+          continue;
+
+        board.decide(i, RACE);
+        if (opts.witness)
+          writeWitness(arg.events, witness, cops[i].first, cops[i].second,
+                       opts);
+      }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < getNumThreads(cops, opts); ++i)
+      workers.emplace_back(worker);
+    for (auto &t : workers)
+      t.join();
+
+    std::vector<size_t> rest;
+    for (size_t i = 0; i < cops.size(); ++i)
+      if (!board.isDecided(i))
+        rest.push_back(i);
+
+    if (opts.verbose)
+      std::cout << "Sync-preserving races: " << cops.size() - rest.size()
+                << ", left to search: " << rest.size() << std::endl
+                << std::endl;
+
+    return rest;
+  }
+
+  void predictPar(CommonArg &arg,
+                  std::vector<std::pair<EventId, EventId>> &cops,
+                  Option &opts) {
+    VerdictBoard board{cops, arg.events.size()};
+
+    std::vector<size_t> indices(cops.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    if (opts.syncPreserving)
+      indices = confirmSyncPreserving(arg, cops, board, opts);
+    runPass(arg, cops, indices, board, opts);
+
+    // Retry pairs that ran out of budget once everything else is done
+    if (opts.retryFactor.has_value() && opts.budget.isLimited()) {
+      std::vector<size_t> retry = board.getCOPs(UNKNOWN);
+      std::erase_if(retry, [&](size_t i) { return !board.reopen(i); });
+
+      if (!retry.empty()) {
+        Option retryOpts = opts;
+        retryOpts.budget = opts.budget.scaled(opts.retryFactor.value());
+
+        if (opts.verbose)
+          std::cout << "Retrying " << retry.size()
+                    << " pairs with larger budgets..." << std::endl
+                    << std::endl;
+
+        runPass(arg, cops, retry, board, retryOpts);
+      }
+    }
+
+    for (size_t i : board.getCOPs(RACE))
+      races.push_back(cops[i]);
+    for (size_t i : board.getCOPs(UNKNOWN))
+      unknowns.push_back(cops[i]);
   }
 
 public:
@@ -123,7 +262,7 @@ public:
         opts{opts_} {}
 
   void predict() {
-    PreprocessResult pr = preprocess(events, thread_to_tid_map);
+    PreprocessResult pr = preprocessCached(events, thread_to_tid_map, opts);
 
     // auto i = 0;
     if (opts.verbose) {
@@ -139,6 +278,8 @@ public:
 
   void reportRaces(Option &opt) {
     std::cout << "Num races: " << races.size() << std::endl;
+    if (!unknowns.empty())
+      std::cout << "Num unknown: " << unknowns.size() << std::endl;
 
     if (opt.verbose) {
       std::cout
@@ -150,6 +291,16 @@ public:
         std::cout << '(' << e1.getEventNum() << ", " << e2.getEventNum() << ')'
                   << std::endl;
       }
+
+      if (!unknowns.empty()) {
+        std::cout << "Unknown, out of budget:" << std::endl;
+        for (auto p : unknowns) {
+          Event e1 = getEvent(events, p.first);
+          Event e2 = getEvent(events, p.second);
+          std::cout << '(' << e1.getEventNum() << ", " << e2.getEventNum()
+                    << ')' << std::endl;
+        }
+      }
     }
   }
 };
@@ -1,22 +1,28 @@
+#include <algorithm>
+#include <atomic>
 #include <numeric>
+#include <ranges>
+#include <span>
 #include <unordered_set>
 
 #include "event.hpp"
+#include "parallel.hpp"
 #include "preprocesser.hpp"
 
 PreprocessResult
 preprocess(std::vector<std::vector<Event>> &events,
-           std::unordered_map<uint32_t, tid_t> &thread_to_tid_map) {
+           std::unordered_map<uint32_t, tid_t> &thread_to_tid_map,
+           size_t num_threads) {
   std::vector<EventId> writes;
   std::vector<EventId> reads;
   std::vector<EventId> joins;
   std::vector<EventId> forks;
-  std::unordered_map<EventId, std::unordered_set<vid_t>> event_to_lock_map;
+  LocksetTable locksets{events};
 
-  CommonArg arg = initialize(events, writes, reads, joins, forks,
-                             event_to_lock_map, thread_to_tid_map);
-  std::unordered_set<std::pair<EventId, EventId>> cops =
-      generateCOPs(events, writes, reads, event_to_lock_map, arg.closure);
+  CommonArg arg = initialize(events, writes, reads, joins, forks, locksets,
+                             thread_to_tid_map);
+  std::unordered_set<std::pair<EventId, EventId>> cops = generateCOPs(
+      events, writes, reads, locksets, arg.closure, num_threads);
 
   return {arg, cops};
 }
@@ -24,8 +30,7 @@ preprocess(std::vector<std::vector<Event>> &events,
 CommonArg initialize(
     std::vector<std::vector<Event>> &events, std::vector<EventId> &writes,
     std::vector<EventId> &reads, std::vector<EventId> &joins,
-    std::vector<EventId> &forks,
-    std::unordered_map<EventId, std::unordered_set<vid_t>> &event_to_lock_map,
+    std::vector<EventId> &forks, LocksetTable &locksets,
     std::unordered_map<uint32_t, tid_t> &thread_to_tid_map) {
   std::unordered_map<vid_t, std::unordered_map<uint32_t, std::vector<EventId>>>
       var_to_write_map;
@@ -44,6 +49,7 @@ CommonArg initialize(
 
   for (tid_t i = 0; i < events.size(); ++i) {
     std::unordered_map<vid_t, EventId> acquiredLocks;
+    lsid_t held = 0; // interned lockset of acquiredLocks
 
     for (eid_t j = 0; j < events[i].size(); ++j) {
       Event &e = events[i][j];
@@ -51,27 +57,25 @@ CommonArg initialize(
       switch (e.getEventType()) {
       case EventType::Acquire:
         acquiredLocks[e.getVarId()] = id;
+        held = locksets.intern(std::views::keys(acquiredLocks));
         break;
       case EventType::Release: {
         vid_t l = e.getVarId();
         acq_rel_map[acquiredLocks[l]] = id;
         acquiredLocks.erase(l);
+        held = locksets.intern(std::views::keys(acquiredLocks));
         break;
       }
       case EventType::Read: {
         var_to_read_map[e.getVarId()][e.getVarValue()].push_back(id);
         reads.push_back(id);
-        for (auto [l, _] : acquiredLocks) {
-          event_to_lock_map[id].insert(l);
-        }
+        locksets.setLockset(id, held);
         break;
       }
       case EventType::Write: {
         writes.push_back(id);
         var_to_write_map[e.getVarId()][e.getVarValue()].push_back(id);
-        for (auto [l, _] : acquiredLocks) {
-          event_to_lock_map[id].insert(l);
-        }
+        locksets.setLockset(id, held);
         break;
       }
       case EventType::Fork: {
@@ -105,7 +109,52 @@ CommonArg initialize(
                    thread_to_tid_map,
                    acq_rel_map,
                    begin_fork_map,
-                   clj};
+                   clj,
+                   indexAccesses(events)};
+}
+
+AccessIndex indexAccesses(const std::vector<std::vector<Event>> &events) {
+  AccessIndex index;
+  index.vars.resize(events.size());
+  index.offsets.resize(events.size());
+  index.eids.resize(events.size());
+
+  for (tid_t t = 0; t < events.size(); ++t) {
+    auto isAccess = [&](eid_t eid) {
+      return events[t][eid].getEventType() == EventType::Read ||
+             events[t][eid].getEventType() == EventType::Write;
+    };
+
+    // 1. Number the variables in order of first access and count accesses
+    std::unordered_map<vid_t, uint32_t> slot;
+    std::vector<uint32_t> counts;
+    for (eid_t eid = 0; eid < events[t].size(); ++eid) {
+      if (!isAccess(eid))
+        continue;
+
+      auto [it, inserted] =
+          slot.try_emplace(events[t][eid].getVarId(), counts.size());
+      if (inserted) {
+        index.vars[t].push_back(events[t][eid].getVarId());
+        counts.push_back(0);
+      }
+      ++counts[it->second];
+    }
+
+    // 2. Lay out the accesses of each variable after those of the previous
+    std::vector<uint32_t> &offsets = index.offsets[t];
+    offsets.assign(counts.size() + 1, 0);
+    for (size_t k = 0; k < counts.size(); ++k)
+      offsets[k + 1] = offsets[k] + counts[k];
+
+    index.eids[t].resize(offsets.back());
+    std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+    for (eid_t eid = 0; eid < events[t].size(); ++eid)
+      if (isAccess(eid))
+        index.eids[t][fill[slot[events[t][eid].getVarId()]]++] = eid;
+  }
+
+  return index;
 }
 
 Closure buildClosure(
@@ -155,30 +204,125 @@ Closure buildClosure(
   return cb.build(inputTrace, events);
 }
 
+/* Accesses to a single variable, each list ordered by thread and then by
+ * program order */
+struct VarAccesses {
+  std::vector<EventId> writes;
+  std::vector<EventId> reads;
+};
+
+/* Splits accesses ordered by thread into one run per thread */
+static std::vector<std::span<const EventId>>
+splitByThread(const std::vector<EventId> &accesses) {
+  std::vector<std::span<const EventId>> runs;
+  size_t begin = 0;
+  for (size_t i = 1; i <= accesses.size(); ++i)
+    if (i == accesses.size() ||
+        accesses[i].getTid() != accesses[begin].getTid()) {
+      runs.push_back(std::span{accesses}.subspan(begin, i - begin));
+      begin = i;
+    }
+
+  return runs;
+}
+
+/* Adds COPs between the writes of one thread and the accesses of another
+ * thread to the same variable.
+ *
+ * The accesses ordered before a write w form a prefix of the other thread's
+ * run, those ordered after w a suffix, so only the window in between needs to
+ * be checked for common locks. Both ends of the window only move forward as w
+ * advances in program order. */
+static void sweepThreadPair(
+    std::span<const EventId> writes, std::span<const EventId> others,
+    std::vector<std::vector<Event>> &events, LocksetCache &locks,
+    const Closure &clj, std::vector<std::pair<EventId, EventId>> &cops) {
+  tid_t t1 = writes.front().getTid();
+  tid_t t2 = others.front().getTid();
+  size_t lo = 0, hi = 0;
+
+  for (auto w : writes) {
+    // others[lo..] did not happen before w
+    uint32_t seen = clj.clockAt(w, t2);
+    while (lo < others.size() && others[lo].getEid() < seen)
+      ++lo;
+
+    // w did not happen before others[..hi]
+    uint32_t epoch = clj.epochOf(w);
+    hi = std::max(hi, lo);
+    while (hi < others.size() && clj.clockAt(others[hi], t1) < epoch)
+      ++hi;
+
+    for (size_t i = lo; i < hi; ++i)
+      if (!hasCommonLock(w, others[i], locks))
+        cops.push_back(makeCOP(events, w, others[i]));
+  }
+}
+
 std::unordered_set<std::pair<EventId, EventId>> generateCOPs(
     std::vector<std::vector<Event>> &events, std::vector<EventId> &writes,
-    std::vector<EventId> &reads,
-    std::unordered_map<EventId, std::unordered_set<vid_t>> &event_to_lock_map,
-    Closure &clj) {
-  std::unordered_set<std::pair<EventId, EventId>> cops;
+    std::vector<EventId> &reads, const LocksetTable &locksets, Closure &clj,
+    size_t num_threads) {
+  // Group accesses by variable, writes and reads are already ordered by thread
+  std::unordered_map<vid_t, size_t> var_index;
+  std::vector<VarAccesses> vars;
+  auto accessesOf = [&](EventId id) -> VarAccesses & {
+    auto [it, inserted] =
+        var_index.try_emplace(getEvent(events, id).getVarId(), vars.size());
+    if (inserted)
+      vars.emplace_back();
+    return vars[it->second];
+  };
 
-  // Generate COP pairs
-  for (size_t i = 0; i < writes.size(); ++i) {
-    auto w = writes[i];
+  for (auto w : writes)
+    accessesOf(w).writes.push_back(w);
+  for (auto r : reads)
+    accessesOf(r).reads.push_back(r);
 
-    // // Add <write, write> COP pairs
-    for (size_t j = 1; j < writes.size(); ++j) {
-      auto w2 = writes[j];
-      if (isCandidateRace(w, w2, events, event_to_lock_map, clj))
-        cops.insert(makeCOP(events, w, w2));
-    }
+  // Variables without writes cannot race. Start with the most accesses so a
+  // few large variables do not end up last on a single thread.
+  std::erase_if(vars, [](const VarAccesses &v) { return v.writes.empty(); });
+  std::sort(vars.begin(), vars.end(),
+            [](const VarAccesses &a, const VarAccesses &b) {
+              return a.writes.size() * (a.writes.size() + a.reads.size()) >
+                     b.writes.size() * (b.writes.size() + b.reads.size());
+            });
 
-    // Add <write, read> COP pairs
-    for (auto r : reads) {
-      if (isCandidateRace(w, r, events, event_to_lock_map, clj))
-        cops.insert(makeCOP(events, w, r));
+  num_threads = std::max<size_t>(1, std::min(num_threads, vars.size()));
+  std::vector<std::vector<std::pair<EventId, EventId>>> found(num_threads);
+  std::atomic<size_t> idx{0};
+
+  runParallel(num_threads, [&](size_t worker) {
+    std::vector<std::pair<EventId, EventId>> &cops = found[worker];
+    LocksetCache locks{locksets};
+
+    while (true) {
+      size_t i = idx.fetch_add(1, std::memory_order_relaxed);
+      if (i >= vars.size())
+        return;
+
+      std::vector<std::span<const EventId>> writeRuns =
+          splitByThread(vars[i].writes);
+      std::vector<std::span<const EventId>> readRuns =
+          splitByThread(vars[i].reads);
+
+      for (size_t a = 0; a < writeRuns.size(); ++a) {
+        // <write, write> COP pairs, each pair of threads once
+        for (size_t b = a + 1; b < writeRuns.size(); ++b)
+          sweepThreadPair(writeRuns[a], writeRuns[b], events, locks, clj,
+                          cops);
+
+        // <write, read> COP pairs
+        for (auto run : readRuns)
+          if (run.front().getTid() != writeRuns[a].front().getTid())
+            sweepThreadPair(writeRuns[a], run, events, locks, clj, cops);
+      }
     }
-  }
+  });
+
+  std::unordered_set<std::pair<EventId, EventId>> cops;
+  for (auto &worker : found)
+    cops.insert(worker.begin(), worker.end());
 
   return cops;
 }
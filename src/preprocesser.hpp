@@ -6,6 +6,17 @@
 
 #include "closure.hpp"
 #include "event.hpp"
+#include "lockset.hpp"
+
+/* Reads and writes of each thread, grouped by variable in CSR form. The
+ * variables thread t accesses are vars[t], in order of their first access,
+ * and the eids of its accesses of vars[t][k] are eids[t][offsets[t][k]] up to
+ * eids[t][offsets[t][k + 1]], in order. */
+struct AccessIndex {
+  std::vector<std::vector<vid_t>> vars;
+  std::vector<std::vector<uint32_t>> offsets;
+  std::vector<std::vector<eid_t>> eids;
+};
 
 struct CommonArg {
   /* Vector of each threads' events, ordered by program order */
@@ -34,6 +45,10 @@ struct CommonArg {
   /* Transitive, reflexive closure of PO, Fork-Begin, End-Join, RF for
    * sole-writers */
   Closure closure;
+
+  /* For each thread, the eids of its reads and writes of each variable.
+   * Derived from events, see indexAccesses. */
+  AccessIndex thread_accesses;
 };
 
 struct PreprocessResult {
@@ -45,6 +60,23 @@ struct PreprocessResult {
  *  Helper functions for preprocessing
  */
 
+/* Returns the events of var with value val in var_to_write_map or
+ * var_to_read_map. Unlike operator[] this never inserts, so CommonArg can be
+ * read from several threads at once. */
+inline const std::vector<EventId> &getAccesses(
+    const std::unordered_map<
+        vid_t, std::unordered_map<uint32_t, std::vector<EventId>>> &map,
+    vid_t var, uint32_t val) {
+  static const std::vector<EventId> none;
+
+  auto values = map.find(var);
+  if (values == map.end())
+    return none;
+
+  auto accesses = values->second.find(val);
+  return accesses == values->second.end() ? none : accesses->second;
+}
+
 inline bool isSameThread(EventId e1, EventId e2) {
   return e1.getTid() == e2.getTid();
 }
@@ -54,17 +86,8 @@ inline bool isSameVar(EventId e1, EventId e2,
   return getEvent(events, e1).getVarId() == getEvent(events, e2).getVarId();
 }
 
-inline bool hasCommonLock(
-    EventId e1, EventId e2,
-    std::unordered_map<EventId, std::unordered_set<vid_t>> &event_to_lock_map) {
-  if (!event_to_lock_map.contains(e1) || !event_to_lock_map.contains(e2))
-    return false;
-
-  for (auto l : event_to_lock_map[e1])
-    if (event_to_lock_map[e2].contains(l))
-      return true;
-
-  return false;
+inline bool hasCommonLock(EventId e1, EventId e2, LocksetCache &locks) {
+  return locks.hasCommonLock(e1, e2);
 }
 
 /* Returns if e1 and e2 is ordered by Closure */
@@ -73,12 +96,11 @@ inline bool hasHappensBeforeOrdering(EventId e1, EventId e2, Closure &clj) {
 }
 
 /* Filters cop pair (e1, e2), returns false if they are not an actual race */
-inline bool isCandidateRace(
-    EventId e1, EventId e2, std::vector<std::vector<Event>> &events,
-    std::unordered_map<EventId, std::unordered_set<vid_t>> &event_to_lock_map,
-    Closure &clj) {
+inline bool isCandidateRace(EventId e1, EventId e2,
+                            std::vector<std::vector<Event>> &events,
+                            LocksetCache &locks, Closure &clj) {
   return !isSameThread(e1, e2) && isSameVar(e1, e2, events) &&
-         !hasCommonLock(e1, e2, event_to_lock_map) &&
+         !hasCommonLock(e1, e2, locks) &&
          !hasHappensBeforeOrdering(e1, e2, clj);
 }
 
@@ -86,10 +108,12 @@ inline bool isCandidateRace(
  * Declarations for preprocessing functions
  */
 
-/* Preprocesses input traces and extracts relevant information */
+/* Preprocesses input traces and extracts relevant information, generating
+ * COPs on up to num_threads threads */
 PreprocessResult
 preprocess(std::vector<std::vector<Event>> &events,
-           std::unordered_map<uint32_t, tid_t> &thread_to_tid_map);
+           std::unordered_map<uint32_t, tid_t> &thread_to_tid_map,
+           size_t num_threads = 1);
 
 /* Transforms and extracts relevant information for preprocessing from input
  * trace
@@ -97,16 +121,19 @@ preprocess(std::vector<std::vector<Event>> &events,
 CommonArg initialize(
     std::vector<std::vector<Event>> &events, std::vector<EventId> &writes,
     std::vector<EventId> &reads, std::vector<EventId> &joins,
-    std::vector<EventId> &forks,
-    std::unordered_map<EventId, std::unordered_set<vid_t>> &event_to_lock_map,
+    std::vector<EventId> &forks, LocksetTable &locksets,
     std::unordered_map<uint32_t, tid_t> &thread_to_tid_map);
 
-/* Generates a set of candidate data races */
+/* Generates a set of candidate data races. Accesses are grouped by variable
+ * and variables are processed in parallel on up to num_threads threads. */
 std::unordered_set<std::pair<EventId, EventId>> generateCOPs(
     std::vector<std::vector<Event>> &events, std::vector<EventId> &writes,
-    std::vector<EventId> &reads,
-    std::unordered_map<EventId, std::unordered_set<vid_t>> &event_to_lock_map,
-    Closure &clj);
+    std::vector<EventId> &reads, const LocksetTable &locksets, Closure &clj,
+    size_t num_threads = 1);
+
+/* Returns the eids of the reads and writes of each variable by each thread,
+ * for CommonArg::thread_accesses */
+AccessIndex indexAccesses(const std::vector<std::vector<Event>> &events);
 
 /* Builds Closure based on a vector clock algorithm */
 Closure buildClosure(
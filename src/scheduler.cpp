@@ -0,0 +1,65 @@
+#include <atomic>
+
+#include "iset.hpp"
+#include "parallel.hpp"
+#include "scheduler.hpp"
+
+/* Returns for each thread the number of reads before each eid that have more
+ * than one good write */
+static std::vector<std::vector<uint32_t>> countAmbiguousReads(CommonArg &arg) {
+  std::vector<std::vector<uint32_t>> prefix(arg.events.size());
+
+  for (tid_t i = 0; i < arg.events.size(); ++i) {
+    prefix[i].reserve(arg.events[i].size() + 1);
+    prefix[i].push_back(0);
+
+    for (const Event &e : arg.events[i]) {
+      uint32_t ambiguous = 0;
+      if (e.getEventType() == EventType::Read) {
+        auto values = arg.var_to_write_map.find(e.getVarId());
+        if (values != arg.var_to_write_map.end()) {
+          auto writes = values->second.find(e.getVarValue());
+          ambiguous = writes != values->second.end() && writes->second.size() > 1;
+        }
+      }
+      prefix[i].push_back(prefix[i].back() + ambiguous);
+    }
+  }
+
+  return prefix;
+}
+
+std::vector<double>
+estimateCosts(const std::vector<std::pair<EventId, EventId>> &cops,
+              CommonArg &arg, size_t num_threads) {
+  std::vector<std::vector<uint32_t>> ambiguous = countAmbiguousReads(arg);
+  std::vector<double> costs(cops.size(), 0);
+  std::atomic<size_t> idx{0};
+
+  num_threads = std::max<size_t>(1, std::min(num_threads, cops.size()));
+  runParallel(num_threads, [&](size_t) {
+    while (true) {
+      size_t i = idx.fetch_add(1, std::memory_order_relaxed);
+      if (i >= cops.size())
+        return;
+
+      std::vector<eid_t> iset =
+          getIncludeSet(cops[i].first, cops[i].second, arg.events, arg);
+
+      double size = 0, threads = 0, reads = 0;
+      for (tid_t t = 0; t < iset.size(); ++t) {
+        if (iset[t] == UNUSED)
+          continue;
+
+        size += iset[t] + 1;
+        threads += 1;
+        reads += ambiguous[t][std::min<size_t>(iset[t] + 1,
+                                               arg.events[t].size())];
+      }
+
+      costs[i] = size * threads * (1 + reads);
+    }
+  });
+
+  return costs;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "event.hpp"
+#include "preprocesser.hpp"
+
+/* Returns an estimate of the cost of verifying each COP, computed on up to
+ * num_threads threads. The estimate grows with the size of the COP's include
+ * set, the number of threads it spans and the number of its reads that can
+ * read from more than one write. Include sets are freed once estimated, as
+ * keeping them for every COP would take COPs x threads eids. */
+std::vector<double>
+estimateCosts(const std::vector<std::pair<EventId, EventId>> &cops,
+              CommonArg &arg, size_t num_threads);
+
+/* Hands out COPs to prediction workers, most expensive first.
+ *
+ * COPs are sorted by estimated cost and dealt round robin into one deque per
+ * worker. A worker takes from the front of its own deque, and once that is
+ * empty steals from the back of the other workers' deques. */
+class Scheduler {
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<size_t> tasks;
+  };
+
+  std::vector<Queue> queues;
+
+  std::optional<size_t> popFront(Queue &q) {
+    std::lock_guard<std::mutex> lock{q.mutex};
+    if (q.tasks.empty())
+      return std::nullopt;
+
+    size_t task = q.tasks.front();
+    q.tasks.pop_front();
+    return task;
+  }
+
+  std::optional<size_t> popBack(Queue &q) {
+    std::lock_guard<std::mutex> lock{q.mutex};
+    if (q.tasks.empty())
+      return std::nullopt;
+
+    size_t task = q.tasks.back();
+    q.tasks.pop_back();
+    return task;
+  }
+
+public:
+  Scheduler(const std::vector<double> &costs, size_t numWorkers)
+      : queues(std::max<size_t>(numWorkers, 1)) {
+    std::vector<size_t> order(costs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](size_t a, size_t b) { return costs[a] > costs[b]; });
+
+    for (size_t i = 0; i < order.size(); ++i)
+      queues[i % queues.size()].tasks.push_back(order[i]);
+  }
+
+  Scheduler(const Scheduler &) = delete;
+  Scheduler &operator=(const Scheduler &) = delete;
+
+  /* Returns the next COP for worker, or nothing once all COPs are taken */
+  std::optional<size_t> next(size_t worker) {
+    if (auto task = popFront(queues[worker]))
+      return task;
+
+    for (size_t i = 1; i < queues.size(); ++i)
+      if (auto task = popBack(queues[(worker + i) % queues.size()]))
+        return task;
+
+    return std::nullopt;
+  }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "errors.hpp"
+#include "event.hpp"
+
+/*
+** Helpers for the binary on-disk formats (compressed traces, preprocessing
+** cache). Values are stored in host byte order, like raw input traces.
+*/
+
+/* Maps signed deltas to unsigned so that small magnitudes encode small */
+inline uint32_t zigzag(int32_t v) {
+  return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31);
+}
+
+inline int32_t unzigzag(uint32_t v) {
+  return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1);
+}
+
+class BinaryWriter {
+private:
+  std::vector<uint8_t> buf;
+
+public:
+  BinaryWriter() = default;
+
+  template <typename T> void put(const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    putBytes(&value, sizeof(T));
+  }
+
+  void putBytes(const void *data, size_t size) {
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    buf.insert(buf.end(), p, p + size);
+  }
+
+  /* LEB128 encoding, 7 bits per byte */
+  void putVarint(uint64_t value) {
+    while (value >= 0x80) {
+      buf.push_back(static_cast<uint8_t>(value) | 0x80);
+      value >>= 7;
+    }
+    buf.push_back(static_cast<uint8_t>(value));
+  }
+
+  /* Writes a length-prefixed vector of trivially copyable elements */
+  template <typename T> void putVector(const std::vector<T> &v) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    put<uint64_t>(v.size());
+    putBytes(v.data(), v.size() * sizeof(T));
+  }
+
+  void putEventId(const EventId &id) {
+    put<tid_t>(id.getTid());
+    put<uint64_t>(id.getEid());
+  }
+
+  /* Overwrites a previously written value at offset */
+  template <typename T> void patch(size_t offset, const T &value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::memcpy(buf.data() + offset, &value, sizeof(T));
+  }
+
+  size_t size() const { return buf.size(); }
+  const std::vector<uint8_t> &data() const { return buf; }
+};
+
+/* Bounds-checked reader over an in-memory (typically mapped) buffer. Throws
+ * FormatError when reading past the end. */
+class BinaryReader {
+private:
+  const uint8_t *begin;
+  const uint8_t *p;
+  const uint8_t *end;
+
+  void require(size_t size) const {
+    if (static_cast<size_t>(end - p) < size)
+      throw FormatError{"unexpected end of data"};
+  }
+
+public:
+  BinaryReader(const void *data, size_t size)
+      : begin{static_cast<const uint8_t *>(data)}, p{begin},
+        end{begin + size} {}
+
+  template <typename T> T get() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    require(sizeof(T));
+    std::memcpy(&value, p, sizeof(T));
+    p += sizeof(T);
+    return value;
+  }
+
+  const uint8_t *getBytes(size_t size) {
+    require(size);
+    const uint8_t *bytes = p;
+    p += size;
+    return bytes;
+  }
+
+  uint64_t getVarint() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+      require(1);
+      uint8_t byte = *p++;
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0)
+        return value;
+    }
+    throw FormatError{"varint too long"};
+  }
+
+  EventId getEventId() {
+    tid_t tid = get<tid_t>();
+    eid_t eid = get<uint64_t>();
+    return {tid, eid};
+  }
+
+  /* Reads an EventId, rejecting ids that are not events of events. With
+   * allowUnset, the default EventId{} is accepted as well. */
+  EventId getEventId(const std::vector<std::vector<Event>> &events,
+                     bool allowUnset = false) {
+    EventId id = getEventId();
+    if (allowUnset && id == EventId{})
+      return id;
+
+    if (id.getTid() >= events.size() ||
+        id.getEid() >= events[id.getTid()].size())
+      throw FormatError{"event id out of range"};
+    return id;
+  }
+
+  /* Reads an element count, rejecting counts the remaining data cannot hold */
+  uint64_t getCount(size_t elementSize = 1) {
+    uint64_t n = get<uint64_t>();
+    if (n > remaining() / elementSize)
+      throw FormatError{"element count exceeds data"};
+    return n;
+  }
+
+  template <typename T> std::vector<T> getVector() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    uint64_t n = getCount(sizeof(T));
+    std::vector<T> v(n);
+    if (n > 0)
+      std::memcpy(v.data(), getBytes(n * sizeof(T)), n * sizeof(T));
+    return v;
+  }
+
+  void seek(size_t offset) {
+    if (offset > static_cast<size_t>(end - begin))
+      throw FormatError{"offset out of range"};
+    p = begin + offset;
+  }
+
+  size_t position() const { return p - begin; }
+  size_t remaining() const { return end - p; }
+};
+
+/* Writes a buffer to filename, replacing any existing file */
+inline void writeBinaryFile(const std::string &filename, const void *data,
+                            size_t size) {
+  std::ofstream file{filename, std::ios::binary | std::ios::trunc};
+  if (!file.is_open())
+    throw std::runtime_error{"Failed to open output file " + filename};
+
+  file.write(static_cast<const char *>(data), size);
+  if (!file)
+    throw std::runtime_error{"Failed to write output file " + filename};
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+/*
+** How the search for a single COP picks the next reordering to expand
+*/
+
+/* Weights of the heuristic of Trace::computePriority, lower priorities are
+ * closer to witnessing the COP */
+struct SearchWeights {
+  uint32_t distance = 100;   // per event left before e1 or e2
+  uint32_t predecessors = 20; // per unexecuted predecessor of a blocked event
+  uint32_t release = 2;       // per event left before an event that unblocks
+  uint32_t goodWrites = 1;    // per event left before a write a read needs
+  uint32_t threshold = 80;    // cap on the cost of unblocking an event
+};
+
+/* Order in which reorderings are expanded */
+enum class SearchStrategy : uint8_t {
+  BEST_FIRST, // lowest priority first
+  DFS,        // deepest first, lowest priority among the deepest
+  BFS,        // shallowest first, lowest priority among the shallowest
+  BEAM,       // as BFS, but only the best reorderings at each depth
+};
+
+/* Returns the key a reordering at depth with priority is expanded by, lowest
+ * first, in a search whose reorderings are at most maxDepth deep. Keys are
+ * below UINT64_MAX. */
+inline uint64_t strategyKey(SearchStrategy strategy, uint32_t depth,
+                            uint32_t priority, uint32_t maxDepth) {
+  switch (strategy) {
+  case SearchStrategy::DFS:
+    return (static_cast<uint64_t>(depth < maxDepth ? maxDepth - depth : 0)
+            << 32) |
+           priority;
+  case SearchStrategy::BFS:
+  case SearchStrategy::BEAM:
+    return (static_cast<uint64_t>(depth) << 32) | priority;
+  case SearchStrategy::BEST_FIRST:
+  default:
+    return priority;
+  }
+}
+
+/* Returns the largest key of a search whose reorderings are at most maxDepth
+ * deep and have priorities up to maxPriority */
+inline uint64_t maxStrategyKey(SearchStrategy strategy, uint32_t maxDepth,
+                               uint32_t maxPriority) {
+  return strategyKey(strategy, strategy == SearchStrategy::DFS ? 0 : maxDepth,
+                     maxPriority, maxDepth);
+}
+
+/* Parses one of best, dfs, bfs and beam */
+inline SearchStrategy parseStrategy(const std::string &name) {
+  if (name == "best")
+    return SearchStrategy::BEST_FIRST;
+  if (name == "dfs")
+    return SearchStrategy::DFS;
+  if (name == "bfs")
+    return SearchStrategy::BFS;
+  if (name == "beam")
+    return SearchStrategy::BEAM;
+
+  throw std::runtime_error{"Unknown search strategy " + name +
+                           ", expected best, dfs, bfs or beam"};
+}
+
+/* Parses two strategies separated by a comma */
+inline std::pair<SearchStrategy, SearchStrategy>
+parsePortfolio(const std::string &str) {
+  size_t comma = str.find(',');
+  if (comma == std::string::npos)
+    throw std::runtime_error{"Portfolio must be two strategies, e.g. best,dfs"};
+
+  return {parseStrategy(str.substr(0, comma)),
+          parseStrategy(str.substr(comma + 1))};
+}
+
+/* Overrides weights from a list of name=value pairs separated by commas,
+ * e.g. distance=50,threshold=200 */
+inline void parseWeights(SearchWeights &weights, const std::string &str) {
+  std::stringstream ss{str};
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    size_t eq = item.find('=');
+    if (eq == std::string::npos)
+      throw std::runtime_error{"Invalid weight " + item + ", expected name=value"};
+
+    std::string name = item.substr(0, eq);
+    uint32_t value;
+    try {
+      value = static_cast<uint32_t>(std::stoul(item.substr(eq + 1)));
+    } catch (const std::exception &e) {
+      throw std::runtime_error{"Invalid value for weight " + name};
+    }
+
+    if (name == "distance")
+      weights.distance = value;
+    else if (name == "predecessors")
+      weights.predecessors = value;
+    else if (name == "release")
+      weights.release = value;
+    else if (name == "goodWrites")
+      weights.goodWrites = value;
+    else if (name == "threshold")
+      weights.threshold = value;
+    else
+      throw std::runtime_error{"Unknown weight " + name};
+  }
+}
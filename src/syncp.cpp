@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <functional>
+#include <queue>
+
+#include "syncp.hpp"
+
+SyncPreserving::SyncPreserving(CommonArg &arg_)
+    : arg{arg_}, acquires(arg_.events.size()), from(arg_.events.size()) {
+  for (tid_t t = 0; t < arg.events.size(); ++t)
+    for (eid_t eid = 0; eid < arg.events[t].size(); ++eid)
+      if (arg.events[t][eid].getEventType() == EventType::Acquire)
+        acquires[t][arg.events[t][eid].getVarId()].push_back(eid);
+
+  // One pass over the events in trace order, merged from the threads by event
+  // number. A read reads from the last write of its value before it, any
+  // later write of another value would have been read instead.
+  std::unordered_map<vid_t, std::unordered_map<uint32_t, EventId>> lastWrite;
+  std::priority_queue<std::pair<uint32_t, tid_t>,
+                      std::vector<std::pair<uint32_t, tid_t>>, std::greater<>>
+      next;
+  for (tid_t t = 0; t < arg.events.size(); ++t) {
+    from[t].reserve(arg.events[t].size());
+    if (!arg.events[t].empty())
+      next.push({arg.events[t][0].getEventNum(), t});
+  }
+
+  while (!next.empty()) {
+    tid_t t = next.top().second;
+    next.pop();
+
+    EventId e = {t, static_cast<eid_t>(from[t].size())};
+    const Event &event = arg.events[t][e.getEid()];
+    from[t].push_back(e);
+
+    if (event.getEventType() == EventType::Write) {
+      lastWrite[event.getVarId()].insert_or_assign(event.getVarValue(), e);
+    } else if (event.getEventType() == EventType::Read) {
+      auto values = lastWrite.find(event.getVarId());
+      if (values != lastWrite.end()) {
+        auto w = values->second.find(event.getVarValue());
+        if (w != values->second.end())
+          from[t].back() = w->second;
+      }
+    }
+
+    if (from[t].size() < arg.events[t].size())
+      next.push({arg.events[t][from[t].size()].getEventNum(), t});
+  }
+}
+
+bool SyncPreserving::extend(std::vector<eid_t> &prefix,
+                            const std::vector<eid_t> &bound,
+                            std::vector<Range> &work, tid_t tid,
+                            eid_t end) const {
+  if (end <= prefix[tid])
+    return true;
+  if (end > bound[tid])
+    return false;
+
+  work.push_back({tid, prefix[tid], end});
+  prefix[tid] = end;
+  return true;
+}
+
+bool SyncPreserving::orderCriticalSections(std::vector<eid_t> &prefix,
+                                           const std::vector<eid_t> &bound,
+                                           std::vector<Range> &work) const {
+  // Latest acquire of each thread in the closure, by lock
+  auto lastAcquire = [&](tid_t t, const std::vector<eid_t> &eids) {
+    auto it = std::lower_bound(eids.begin(), eids.end(), prefix[t]);
+    return it == eids.begin() ? UNUSED : *(it - 1);
+  };
+
+  std::unordered_map<vid_t, uint32_t> latest; // by event number
+  for (tid_t t = 0; t < acquires.size(); ++t) {
+    for (const auto &[lock, eids] : acquires[t]) {
+      eid_t acq = lastAcquire(t, eids);
+      if (acq == UNUSED)
+        continue;
+
+      uint32_t num = arg.events[t][acq].getEventNum();
+      auto [it, inserted] = latest.try_emplace(lock, num);
+      if (!inserted)
+        it->second = std::max(it->second, num);
+    }
+  }
+
+  // Critical sections before the latest one on their lock must end in the
+  // closure, earlier ones of a thread end before its latest acquire
+  for (tid_t t = 0; t < acquires.size(); ++t) {
+    for (const auto &[lock, eids] : acquires[t]) {
+      eid_t acq = lastAcquire(t, eids);
+      if (acq == UNUSED || arg.events[t][acq].getEventNum() == latest[lock])
+        continue;
+
+      auto rel = arg.acq_rel_map.find({t, acq});
+      if (rel == arg.acq_rel_map.end() ||
+          !extend(prefix, bound, work, t, rel->second.getEid() + 1))
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool SyncPreserving::isRace(EventId e1, EventId e2,
+                            std::vector<Event> *witness) const {
+  std::vector<eid_t> prefix(arg.events.size(), 0);
+  std::vector<eid_t> bound(arg.events.size());
+  for (tid_t t = 0; t < bound.size(); ++t)
+    bound[t] = arg.events[t].size();
+  bound[e1.getTid()] = e1.getEid();
+  bound[e2.getTid()] = e2.getEid();
+
+  std::vector<Range> work;
+  extend(prefix, bound, work, e1.getTid(), e1.getEid());
+  extend(prefix, bound, work, e2.getTid(), e2.getEid());
+
+  // e1 and e2 need their fork, e.g. when they are the first event of their
+  // thread, but not the write they read from in the input trace
+  for (EventId e : {e1, e2})
+    for (EventId hb : arg.closure.getHappensBefore(e))
+      if (getEvent(arg.events, hb).getEventType() != EventType::Write &&
+          !extend(prefix, bound, work, hb.getTid(), hb.getEid() + 1))
+        return false;
+
+  do {
+    // Close under program order, fork/join and reads-from
+    while (!work.empty()) {
+      Range range = work.back();
+      work.pop_back();
+
+      for (eid_t eid = range.start; eid < range.end; ++eid) {
+        EventId e = {range.tid, eid};
+        for (EventId hb : arg.closure.getHappensBefore(e))
+          if (!extend(prefix, bound, work, hb.getTid(), hb.getEid() + 1))
+            return false;
+
+        if (arg.events[range.tid][eid].getEventType() != EventType::Read)
+          continue;
+
+        EventId w = readsFrom(e);
+        if (w != e && !extend(prefix, bound, work, w.getTid(), w.getEid() + 1))
+          return false;
+      }
+    }
+
+    if (!orderCriticalSections(prefix, bound, work))
+      return false;
+  } while (!work.empty());
+
+  if (witness != nullptr) {
+    witness->clear();
+    for (tid_t t = 0; t < prefix.size(); ++t)
+      witness->insert(witness->end(), arg.events[t].begin(),
+                      arg.events[t].begin() + prefix[t]);
+
+    std::sort(witness->begin(), witness->end(),
+              [](const Event &a, const Event &b) {
+                return a.getEventNum() > b.getEventNum();
+              });
+  }
+
+  return true;
+}
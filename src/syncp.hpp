@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "event.hpp"
+#include "preprocesser.hpp"
+
+/*
+** Sync-preserving race prediction, a sound first tier before the search
+*/
+
+/* Confirms COPs that are sync-preserving races, i.e. that have a witness
+ * which keeps every read reading from the write it read from in the input
+ * trace, and the order of every pair of critical sections on a lock it
+ * contains.
+ *
+ * The witness of (e1, e2) is the sync-preserving closure of the thread
+ * predecessors of e1 and e2: the smallest set of events closed under program
+ * order, fork/join, reads-from and, for any two acquires of a lock in the
+ * set, the release of the earlier one. (e1, e2) is a race iff the closure
+ * contains neither of them, and the closure executed in trace order then
+ * enables both. Every COP it confirms is a race, the others are left to the
+ * search. */
+class SyncPreserving {
+private:
+  CommonArg &arg;
+
+  /* For each thread, the eids of its acquires of each lock, in order */
+  std::vector<std::unordered_map<vid_t, std::vector<eid_t>>> acquires;
+
+  /* For each event, the write it reads from in the input trace if it is a
+   * read, or the event itself if it reads the initial value or is no read */
+  std::vector<std::vector<EventId>> from;
+
+  /* Returns the write read by read r in the input trace, or r itself if it
+   * reads the initial value */
+  EventId readsFrom(EventId r) const { return from[r.getTid()][r.getEid()]; }
+
+  /* Events of a thread added to the closure, whose dependencies are yet to
+   * be added */
+  struct Range {
+    tid_t tid;
+    eid_t start;
+    eid_t end;
+  };
+
+  /* Extends the closure, given by the number of events of each thread in
+   * prefix, to the first end events of thread tid. Returns false if that
+   * exceeds bound, i.e. takes in e1 or e2. */
+  bool extend(std::vector<eid_t> &prefix, const std::vector<eid_t> &bound,
+              std::vector<Range> &work, tid_t tid, eid_t end) const;
+
+  /* Adds the release of every acquire in the closure that a later acquire of
+   * the same lock in the closure follows. Returns false as extend. */
+  bool orderCriticalSections(std::vector<eid_t> &prefix,
+                             const std::vector<eid_t> &bound,
+                             std::vector<Range> &work) const;
+
+public:
+  explicit SyncPreserving(CommonArg &arg_);
+
+  SyncPreserving(const SyncPreserving &) = delete;
+  SyncPreserving &operator=(const SyncPreserving &) = delete;
+
+  /* Returns if (e1, e2) is a sync-preserving race. If so and witness is
+   * given, it is set to the events of the closure, latest first. Safe to call
+   * from several threads at once. */
+  bool isRace(EventId e1, EventId e2,
+              std::vector<Event> *witness = nullptr) const;
+};
@@ -1,35 +1,50 @@
 #include "trace.hpp"
 #include "event.hpp"
+#include <algorithm>
 #include <memory>
 
 bool Trace::isExecutable(CommonArg &arg, std::vector<eid_t> &iset, EventId id,
-                         EventId e1, EventId e2) {
+                         EventId e1, EventId e2, Wait *wait) {
+  auto waitOn = [&](Wait::Kind kind, uint32_t what) {
+    if (wait != nullptr) {
+      wait->kind = kind;
+      wait->id = what;
+    }
+  };
+
+  waitOn(Wait::NONE, 0);
   if (id.getEid() >= COMPLETED || !isIncluded(id, iset))
     return false;
 
   for (auto mhb : arg.closure.getHappensBefore(id))
-    if (!isExecuted(mhb))
+    if (!isExecuted(mhb)) {
+      waitOn(Wait::THREAD, mhb.getTid());
       return false;
+    }
 
   Event event = getEvent(arg.events, id);
 
   switch (event.getEventType()) {
   case EventType::Acquire:
-    if (locks.find(event.getVarId()) == locks.end())
+    waitOn(Wait::LOCK, event.getVarId());
+    if (!locks.contains(event.getVarId()))
       return true;
     break;
   case EventType::Release:
-    if (locks.find(event.getVarId()) != locks.end())
+    waitOn(Wait::LOCK, event.getVarId());
+    if (locks.contains(event.getVarId()))
       return true;
     break;
   case EventType::Write: {
+    waitOn(Wait::VAR, event.getVarId());
     if (!isHeldVar(arg, iset, id, e1, e2))
       return true;
     // return true;
     break;
   }
   case EventType::Read:
-    if (mmap[event.getVarId()] == event.getVarValue())
+    waitOn(Wait::VAR, event.getVarId());
+    if (valueOf(event.getVarId()) == event.getVarValue())
       return true;
     break;
   case EventType::Fork:
@@ -39,6 +54,7 @@ bool Trace::isExecutable(CommonArg &arg, std::vector<eid_t> &iset, EventId id,
                     ? event.getVarId()
                     : arg.tid_map[event.getVarId()];
     EventId endEvent = {tid, arg.events[event.getVarId()].size() - 1};
+    waitOn(Wait::THREAD, tid);
     if (isExecuted(endEvent))
       return true;
     break;
@@ -62,10 +78,20 @@ std::vector<EventId> Trace::getExecutableEvents(CommonArg &arg,
                                                 EventId e1, EventId e2) {
   std::vector<EventId> executables;
 
+  // This node is already shared with other threads, and so may be chunks of
+  // its waits that another thread is copying. Refresh into a copy so that a
+  // chunk is only written in place once this thread has copied it.
+  PersistentArray<Wait> fresh = waits;
+  for (tid_t i = 0; i < events.size(); ++i)
+    if (stale.test(i))
+      fresh.set(i, computeWait(arg, iset, i, e1, e2));
+  waits = std::move(fresh);
+  stale.reset();
+
   for (tid_t i = 0; i < events.size(); ++i) {
     const eid_t eid = events[i];
     EventId id = {i, eid};
-    if (isExecutable(arg, iset, id, e1, e2) && id != e1 && id != e2) {
+    if (waits[i].enabled && id != e1 && id != e2) {
       executables.push_back(id);
     }
   }
@@ -73,59 +99,217 @@ std::vector<EventId> Trace::getExecutableEvents(CommonArg &arg,
   return executables;
 }
 
-void Trace::advanceReads(CommonArg &arg, std::vector<eid_t> &iset, EventId e1,
-                         EventId e2) {
+void Trace::invalidateWaits(const Trace &parent, CommonArg &arg, EventId id) {
+  // Variables written to or accessed by events that now count as executed.
+  // Beyond MAX_VARS, every wait on a variable is taken as stale.
+  static const size_t MAX_VARS = 8;
+  std::array<vid_t, MAX_VARS> vars;
+  size_t numVars = 0;
+  auto touch = [&](vid_t var) {
+    if (numVars < MAX_VARS)
+      vars[numVars] = var;
+    ++numVars;
+  };
+
+  Event event = getEvent(arg.events, id);
+  bool isLockEvent = event.getEventType() == EventType::Acquire ||
+                     event.getEventType() == EventType::Release;
+  if (event.getEventType() == EventType::Write)
+    touch(event.getVarId());
+
+  std::bitset<256> moved;
+  for (tid_t i = 0; i < events.size(); ++i) {
+    eid_t from = parent.events[i];
+    eid_t to = events[i];
+    if (from == to)
+      continue;
+
+    // Events of a completed thread no longer count as executed
+    if (to >= COMPLETED) {
+      stale.set();
+      return;
+    }
+
+    moved.set(i);
+
+    // Accesses up to the new position now count as executed, which decides
+    // if writes to the same variable are held
+    eid_t begin = from < COMPLETED ? from + 1 : FIRST_EVENT;
+    for (eid_t eid = begin; eid <= to && eid < arg.events[i].size(); ++eid) {
+      const Event &e = arg.events[i][eid];
+      if (e.getEventType() == EventType::Read ||
+          e.getEventType() == EventType::Write)
+        touch(e.getVarId());
+    }
+  }
+
+  stale |= moved;
+  for (tid_t i = 0; i < waits.size(); ++i) {
+    const Wait &wait = waits[i];
+    switch (wait.kind) {
+    case Wait::THREAD:
+      if (moved.test(wait.id))
+        stale.set(i);
+      break;
+    case Wait::LOCK:
+      if (isLockEvent && wait.id == event.getVarId())
+        stale.set(i);
+      break;
+    case Wait::VAR:
+      if (numVars > MAX_VARS ||
+          std::find(vars.begin(), vars.begin() + numVars, wait.id) !=
+              vars.begin() + numVars)
+        stale.set(i);
+      break;
+    case Wait::NONE:
+      break;
+    }
+  }
+}
+
+bool Trace::isSquashable(CommonArg &arg, std::vector<eid_t> &iset, EventId id,
+                         EventId e1, EventId e2, const Event *write) {
+  if (id.getEid() >= COMPLETED || !isIncluded(id, iset))
+    return false;
+
+  if (id == e1 || id == e2)
+    return false;
+
+  Event event = getEvent(arg.events, id);
+  if (event.getEventType() != EventType::Read)
+    return false;
+
+  uint32_t value = write != nullptr && write->getVarId() == event.getVarId()
+                       ? write->getVarValue()
+                       : valueOf(event.getVarId());
+  return value == event.getVarValue();
+}
+
+void Trace::advanceReads(CommonArg &arg, std::vector<eid_t> &iset,
+                         const StateEncoder &encoder, EventId e1, EventId e2) {
   for (tid_t i = 0; i < events.size(); ++i) {
     tid_t tid = i;
-    while (true) {
-      EventId id = {tid, events[tid]};
-      if (events[tid] >= COMPLETED || !isIncluded(id, iset))
-        break;
-
-      if ((tid == e1.getTid() && events[tid] == e1.getEid()) ||
-          (tid == e2.getTid() && events[tid] == e2.getEid()))
-        break;
-
-      for (auto mhb : arg.closure.getHappensBefore(id))
-        if (!isExecuted(mhb))
-          break;
-
-      Event event = getEvent(arg.events, id);
-      if (!(event.getEventType() == EventType::Read &&
-            mmap[event.getVarId()] == event.getVarValue())) {
-        break;
-      }
+    while (isSquashable(arg, iset, {tid, events[tid]}, e1, e2)) {
+      Event event = getEvent(arg.events, {tid, events[tid]});
+      setPosition(tid, events[tid] + 1);
+      accessed(encoder, event.getVarId());
+    }
+  }
+}
+
+Trace::Footprint Trace::getFootprint(CommonArg &arg, std::vector<eid_t> &iset,
+                                     EventId id, EventId e1, EventId e2) {
+  Footprint footprint;
+  footprint.moved.set(id.getTid());
+
+  Event event = getEvent(arg.events, id);
+  const Event *write = nullptr;
+  switch (event.getEventType()) {
+  case EventType::Acquire:
+  case EventType::Release:
+    footprint.hasLock = true;
+    footprint.lock = event.getVarId();
+    break;
+  case EventType::Write:
+    write = &event;
+    footprint.touch(event.getVarId());
+    break;
+  case EventType::Read:
+    footprint.touch(event.getVarId());
+    break;
+  default:
+    footprint.global = true;
+    return footprint;
+  }
 
-      ++events[tid];
+  // Replay advanceReads, the accesses it moves threads up to now count as
+  // executed, which decides if writes to the same variable are held
+  for (tid_t i = 0; i < events.size(); ++i) {
+    eid_t from = events[i];
+    if (from >= COMPLETED)
+      continue;
+
+    eid_t to = i == id.getTid() ? from + 1 : from;
+    while (isSquashable(arg, iset, {i, to}, e1, e2, write))
+      ++to;
+
+    if (to == from)
+      continue;
+    footprint.moved.set(i);
+
+    for (eid_t eid = from + 1; eid <= to && eid < arg.events[i].size(); ++eid) {
+      const Event &e = arg.events[i][eid];
+      if (e.getEventType() == EventType::Read ||
+          e.getEventType() == EventType::Write)
+        footprint.touch(e.getVarId());
     }
   }
+
+  return footprint;
+}
+
+std::vector<uint64_t> Trace::reduce(CommonArg &arg, std::vector<eid_t> &iset,
+                                    std::vector<EventId> &executables,
+                                    EventId e1, EventId e2) {
+  // Events that may sleep in successors: the sleeping events, then the
+  // events explored so far
+  std::vector<std::pair<tid_t, Footprint>> sleeping;
+  std::vector<EventId> awake;
+  for (EventId id : executables) {
+    uint64_t bit = id.getTid() < 64 ? uint64_t{1} << id.getTid() : 0;
+    if (sleep & bit)
+      sleeping.emplace_back(id.getTid(), getFootprint(arg, iset, id, e1, e2));
+    else if (redo == 0 || (redo & bit))
+      awake.push_back(id);
+  }
+
+  std::vector<uint64_t> sleeps;
+  for (EventId id : awake) {
+    Footprint footprint = getFootprint(arg, iset, id, e1, e2);
+
+    uint64_t next = 0;
+    for (const auto &[tid, other] : sleeping)
+      if (footprint.commutesWith(other))
+        next |= uint64_t{1} << tid;
+    sleeps.push_back(next);
+
+    if (id.getTid() < 64)
+      sleeping.emplace_back(id.getTid(), footprint);
+  }
+
+  executables = std::move(awake);
+  return sleeps;
 }
 
 std::shared_ptr<Trace> Trace::appendEvent(CommonArg &arg,
-                                          std::vector<eid_t> &iset, EventId id,
-                                          EventId e1, EventId e2) {
-  std::shared_ptr t = std::make_shared<Trace>(*this);
-  t->events[id.getTid()] += 1;
+                                          std::vector<eid_t> &iset,
+                                          const StateEncoder &encoder,
+                                          const SearchWeights &weights,
+                                          EventId id, EventId e1, EventId e2) {
+  std::shared_ptr t = makeNode<Trace>(*this);
+  t->depth = depth + 1;
+  t->setPosition(id.getTid(), events[id.getTid()] + 1);
 
   Event event = getEvent(arg.events, id);
   switch (event.getEventType()) {
   case EventType::Acquire:
-    t->locks[event.getVarId()] = id;
+    t->locks.set(event.getVarId(), id);
     break;
   case EventType::Release:
     t->locks.erase(event.getVarId());
     break;
   case EventType::Write:
-    t->mmap[event.getVarId()] = event.getVarValue();
+    t->setValue(event.getVarId(), event.getVarValue());
+    t->accessed(encoder, event.getVarId());
     break;
   case EventType::Read:
-    // Do nothing
+    t->accessed(encoder, event.getVarId());
     break;
   case EventType::Fork: {
     tid_t tid = arg.tid_map.find(event.getVarId()) == arg.tid_map.end()
                     ? event.getVarId()
                     : arg.tid_map[event.getVarId()];
-    t->events[tid] = FIRST_EVENT;
+    t->setPosition(tid, FIRST_EVENT);
     break;
   }
   case EventType::Join:
@@ -135,7 +319,7 @@ std::shared_ptr<Trace> Trace::appendEvent(CommonArg &arg,
     // Do nothing
     break;
   case EventType::End:
-    t->events[id.getTid()] = COMPLETED;
+    t->setPosition(id.getTid(), COMPLETED);
     break;
   default:
     // Nothing should come here
@@ -144,9 +328,9 @@ std::shared_ptr<Trace> Trace::appendEvent(CommonArg &arg,
     break;
   }
 
-  t->priority = t->computePriority(arg, iset, e1, e2);
-  t->prev = this;
-  t->advanceReads(arg, iset, e1, e2);
+  t->priority = t->computePriority(arg, iset, e1, e2, weights);
+  t->advanceReads(arg, iset, encoder, e1, e2);
+  t->invalidateWaits(*this, arg, id);
 
   return t;
 }
@@ -155,20 +339,20 @@ bool Trace::isHeldVar(CommonArg &arg, std::vector<eid_t> &iset, EventId write,
                       EventId e1, EventId e2) {
   Event e = getEvent(arg.events, write);
   vid_t var = e.getVarId();
-  uint32_t currVal = mmap[var];
+  uint32_t currVal = valueOf(var);
 
   // 1. Check if write writes the same val
   if (e.getVarValue() == currVal)
     return false;
 
   // 2. Check any other write that can write the current value
-  for (auto w : arg.var_to_write_map[var][currVal]) {
+  for (auto w : getAccesses(arg.var_to_write_map, var, currVal)) {
     if (isIncluded(w, iset) && !isExecuted(w))
       return false;
   }
 
   // 3. Check any other read waiting to read this val
-  for (auto r : arg.var_to_read_map[var][currVal]) {
+  for (auto r : getAccesses(arg.var_to_read_map, var, currVal)) {
     if (isIncluded(r, iset) && !isExecuted(r) &&
         (r.getTid() == e1.getTid() ||
          r.getTid() ==
@@ -179,32 +363,29 @@ bool Trace::isHeldVar(CommonArg &arg, std::vector<eid_t> &iset, EventId write,
   return false;
 }
 
-const uint32_t X1 = 100;
-const uint32_t X2 = 20;
-const uint32_t X3 = 2;
-const uint32_t X4 = 1;
-const uint32_t THRESHOLD = 80;
-
 uint32_t Trace::computePriority(CommonArg &arg, std::vector<eid_t> &iset,
-                                EventId e1, EventId e2) {
+                                EventId e1, EventId e2,
+                                const SearchWeights &weights) {
   // 1. Distance to COP
   uint32_t distToCOP =
-      (computeDistance(arg.events, e1) + computeDistance(arg.events, e2)) * X1;
+      (computeDistance(arg.events, e1) + computeDistance(arg.events, e2)) *
+      weights.distance;
 
   uint32_t unblockCost = 0;
 
   // 2. If next event in t1/t2 not executable, compute cost to unblock
   EventId t1Event = {e1.getTid(), events[e1.getTid()]};
   if (t1Event != e1 && !isExecutable(arg, iset, t1Event, e1, e2)) {
-    unblockCost += computeUnblockCost(arg, iset, e1);
+    unblockCost += computeUnblockCost(arg, iset, e1, weights);
   }
 
   EventId t2Event = {e2.getTid(), events[e2.getTid()]};
   if (t2Event != e2 && !isExecutable(arg, iset, t2Event, e1, e2)) {
-    unblockCost += computeUnblockCost(arg, iset, e1);
+    unblockCost += computeUnblockCost(arg, iset, e1, weights);
   }
 
-  // h(x) = distToE1 * X1 + distToE2 * X1 + unblockT1Cost + unblockT2Cost
+  // h(x) = distToE1 * distance + distToE2 * distance + unblockT1Cost +
+  // unblockT2Cost
   return distToCOP + unblockCost;
 }
 
@@ -216,30 +397,35 @@ uint32_t Trace::computeDistance(std::vector<std::vector<Event>> &allEvents,
   if (events[e.getTid()] == COMPLETED || events[e.getTid()] >= e.getEid())
     return 0;
 
-  return e.getTid() - events[e.getTid()];
+  return e.getEid() - events[e.getTid()];
 }
 
 uint32_t Trace::computeUnblockCost(CommonArg &arg, std::vector<eid_t> &iset,
-                                   EventId e) {
+                                   EventId e, const SearchWeights &weights) {
   uint32_t numMHB = 0;
   for (auto hb : arg.closure.getHappensBefore(e))
     if (!isExecuted(hb))
       ++numMHB;
 
-  uint32_t cost = numMHB * X2;
+  uint32_t cost = numMHB * weights.predecessors;
   Event event = getEvent(arg.events, e);
 
   switch (event.getEventType()) {
   case EventType::Acquire: {
-    EventId currAcq = locks[event.getVarId()];
-    cost += computeDistance(arg.events, arg.acq_rel_map[currAcq]) * X3;
+    const EventId *currAcq = locks.find(event.getVarId());
+    if (currAcq == nullptr)
+      break;
+
+    if (auto rel = arg.acq_rel_map.find(*currAcq); rel != arg.acq_rel_map.end())
+      cost += computeDistance(arg.events, rel->second) * weights.release;
     break;
   }
   case EventType::Read: {
     uint32_t totalDist = 0;
     uint32_t numGoodWrites = 0;
 
-    for (auto w : arg.var_to_write_map[event.getVarId()][event.getVarValue()]) {
+    for (auto w : getAccesses(arg.var_to_write_map, event.getVarId(),
+                              event.getVarValue())) {
       if (isIncluded(w, iset) && !isExecuted(w) &&
           w.getTid() !=
               e.getTid()) { // Check if w and e in same thread (implies e < w)
@@ -249,7 +435,7 @@ uint32_t Trace::computeUnblockCost(CommonArg &arg, std::vector<eid_t> &iset,
     }
 
     // Compute cost based on avg dist to good writes
-    cost += totalDist / numGoodWrites * X4;
+    cost += totalDist / numGoodWrites * weights.goodWrites;
     break;
   }
   case EventType::Join: {
@@ -258,11 +444,13 @@ uint32_t Trace::computeUnblockCost(CommonArg &arg, std::vector<eid_t> &iset,
                     : arg.tid_map[event.getVarId()];
     uint32_t distToEnd = computeDistance(
         arg.events, {tid, arg.events[event.getVarId()].size() - 1});
-    cost += distToEnd * X3;
+    cost += distToEnd * weights.release;
     break;
   }
   case EventType::Begin: {
-    cost += computeDistance(arg.events, arg.begin_fork_map[e.getTid()]) * X3;
+    if (auto fork = arg.begin_fork_map.find(e.getTid());
+        fork != arg.begin_fork_map.end())
+      cost += computeDistance(arg.events, fork->second) * weights.release;
     break;
   }
   case EventType::Write:
@@ -275,13 +463,13 @@ uint32_t Trace::computeUnblockCost(CommonArg &arg, std::vector<eid_t> &iset,
     break;
   }
 
-  return cost >= THRESHOLD ? THRESHOLD : cost;
+  return cost >= weights.threshold ? weights.threshold : cost;
 }
 
 void Trace::printTrace() {
   std::cout << "Trace: [";
-  for (auto e : events) {
-    std::cout << e << ", ";
+  for (tid_t i = 0; i < events.size(); ++i) {
+    std::cout << events[i] << ", ";
   }
   std::cout << "]" << std::endl;
 }
@@ -1,24 +1,132 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cstdint>
 #include <memory>
-#include <unordered_map>
 #include <utility>
 
 #include "event.hpp"
+#include "persistent.hpp"
 #include "preprocesser.hpp"
+#include "strategy.hpp"
+#include "visited.hpp"
 
+/* A reordering explored while verifying a COP. Its state is persistent, i.e.
+ * a successor created by appendEvent shares all of it with this node except
+ * for the entries the appended event changes. */
 class Trace {
-  std::unordered_map<vid_t, uint32_t> mmap;
-  std::unordered_map<vid_t, EventId> locks;
-  std::vector<eid_t>
+  /* What the next event of a thread waits on, i.e. the part of the state
+   * besides the thread's own position that decides if it is executable */
+  struct Wait {
+    enum Kind : uint8_t { NONE, THREAD, LOCK, VAR };
+
+    bool enabled = false; // if the next event is executable
+    Kind kind = NONE;
+    uint32_t id = 0; // the tid, lock or variable waited on
+  };
+
+  /* What executing an event from this node reads or changes, including the
+   * reads advanceReads squashes after it. Events with disjoint footprints
+   * lead to the same node in either order, and neither disables the other. */
+  struct Footprint {
+    static const size_t MAX_VARS = 8;
+
+    bool global = false; // forks, joins, begins and ends conflict with all
+    std::bitset<256> moved;
+    bool hasLock = false;
+    vid_t lock = 0;
+    std::array<vid_t, MAX_VARS> vars; // beyond MAX_VARS, conflicts with all
+    size_t numVars = 0;
+
+    void touch(vid_t var) {
+      if (numVars < MAX_VARS)
+        vars[numVars] = var;
+      ++numVars;
+    }
+
+    bool commutesWith(const Footprint &other) const {
+      if (global || other.global || (moved & other.moved).any())
+        return false;
+
+      if (hasLock && other.hasLock && lock == other.lock)
+        return false;
+
+      if (numVars > MAX_VARS || other.numVars > MAX_VARS)
+        return false;
+
+      for (size_t i = 0; i < numVars; ++i)
+        for (size_t j = 0; j < other.numVars; ++j)
+          if (vars[i] == other.vars[j])
+            return false;
+
+      return true;
+    }
+  };
+
+  PersistentMap<uint32_t> mmap;
+  PersistentMap<EventId> locks;
+  PersistentArray<eid_t>
       events; // indices into std::vector<std::vector<Event>> events
-  Trace *prev = nullptr;
+  std::shared_ptr<Trace> prev; // only kept when witnesses are generated
   uint32_t priority = 0;
+  uint32_t depth = 0; // events appended since the initial reordering
+
+  /* Zobrist hash of the thread positions and the values of live variables,
+   * as two independent words */
+  std::array<uint64_t, 2> zobrist{};
+
+  /* Wait of the next event of each thread. appendEvent marks the waits that
+   * the appended event may have changed as stale, and they are recomputed
+   * when the node is expanded, as most nodes never are. */
+  PersistentArray<Wait> waits;
+  std::bitset<256> stale; // tids are 8 bits
+
+  /* Threads whose next event need not be explored from this node, as a
+   * reordering explored elsewhere covers it. Only threads below 64 sleep.
+   * If the state was expanded before, only the threads in redo are explored. */
+  uint64_t sleep = 0;
+  uint64_t redo = 0;
 
   Trace() = default;
 
   /* Helper functions */
+
+  inline void toggle(uint64_t part, uint64_t value) {
+    zobrist[0] ^= zobristKey(part, value, 0);
+    zobrist[1] ^= zobristKey(part, value, 1);
+  }
+
+  /* Moves thread tid to eid, which may be one of the sentinels */
+  inline void setPosition(tid_t tid, eid_t eid) {
+    toggle(2 * tid, events[tid] - COMPLETED);
+    events.set(tid, eid);
+    toggle(2 * tid, eid - COMPLETED);
+  }
+
+  inline void setValue(vid_t var, uint32_t value) {
+    if (const uint32_t *old = mmap.find(var))
+      toggle(2 * var + 1, *old);
+    mmap.set(var, value);
+    toggle(2 * var + 1, value);
+  }
+
+  /* Drops var from the hash once it has been accessed for the last time */
+  inline void accessed(const StateEncoder &encoder, vid_t var) {
+    if (encoder.isLive(*this, var))
+      return;
+
+    if (const uint32_t *value = mmap.find(var))
+      toggle(2 * var + 1, *value);
+  }
+
+  /* Returns the value last written to var, 0 if it has not been written */
+  inline uint32_t valueOf(vid_t var) const {
+    const uint32_t *value = mmap.find(var);
+    return value == nullptr ? 0 : *value;
+  }
+
   bool isHeldVar(CommonArg &arg, std::vector<eid_t> &iset, EventId write,
                  EventId e1, EventId e2);
 
@@ -33,8 +141,31 @@ class Trace {
     return (events[e.getTid()] < COMPLETED && events[e.getTid()] >= e.getEid());
   }
 
+  /* Returns if id can be executed next. If wait is given, it is set to what
+   * the result depends on. */
   bool isExecutable(CommonArg &arg, std::vector<eid_t> &iset, EventId id,
-                    EventId e1, EventId e2);
+                    EventId e1, EventId e2, Wait *wait = nullptr);
+
+  Wait computeWait(CommonArg &arg, std::vector<eid_t> &iset, tid_t tid,
+                   EventId e1, EventId e2) {
+    Wait wait;
+    wait.enabled = isExecutable(arg, iset, {tid, events[tid]}, e1, e2, &wait);
+    return wait;
+  }
+
+  /* Marks the waits of the threads affected by appending id to parent as
+   * stale, i.e. of the threads that moved and those waiting on a thread that
+   * moved or on a lock or variable whose state changed */
+  void invalidateWaits(const Trace &parent, CommonArg &arg, EventId id);
+
+  /* Returns if advanceReads moves past id, i.e. id reads the value last
+   * written to its variable. A write not executed yet may be taken as the
+   * last write. */
+  bool isSquashable(CommonArg &arg, std::vector<eid_t> &iset, EventId id,
+                    EventId e1, EventId e2, const Event *write = nullptr);
+
+  Footprint getFootprint(CommonArg &arg, std::vector<eid_t> &iset, EventId id,
+                         EventId e1, EventId e2);
 
   inline bool isEnabled(EventId e) {
     if (e.getEid() != 0 && events[e.getTid()] != e.getEid())
@@ -45,37 +176,57 @@ class Trace {
 
   /* Methods to compute priority */
   uint32_t computePriority(CommonArg &arg, std::vector<eid_t> &iset, EventId e1,
-                           EventId e2);
+                           EventId e2, const SearchWeights &weights);
   uint32_t computeDistance(std::vector<std::vector<Event>> &allEvents,
                            EventId e);
   uint32_t computeUnblockCost(CommonArg &arg, std::vector<eid_t> &iset,
-                              EventId e);
+                              EventId e, const SearchWeights &weights);
 
 public:
   Trace(CommonArg &arg, std::vector<eid_t> &iset) {
-    events = std::vector(arg.events.size(), FIRST_EVENT);
+    events = PersistentArray<eid_t>(arg.events.size(), FIRST_EVENT);
     for (tid_t i = 0; i < events.size(); ++i) {
       if (iset[i] == UNUSED) {
-        events[i] = UNUSED;
+        events.set(i, UNUSED);
         continue;
       }
 
       if (arg.begin_fork_map.find(i) != arg.begin_fork_map.end()) {
-        events[i] = TO_BE_FORKED;
+        events.set(i, TO_BE_FORKED);
         continue;
       }
     }
+
+    for (tid_t i = 0; i < events.size(); ++i)
+      toggle(2 * i, events[i] - COMPLETED);
+
+    waits = PersistentArray<Wait>(events.size(), Wait{});
+    stale.set();
   }
 
   Trace(const Trace &) = default;
   Trace(Trace &&) = default;
 
+  ~Trace() {
+    // Release long chains of predecessors one at a time, not recursively
+    std::shared_ptr<Trace> p = std::move(prev);
+    while (p != nullptr && p.use_count() == 1) {
+      std::shared_ptr<Trace> next = std::move(p->prev);
+      p = std::move(next);
+    }
+  }
+
   Trace &operator=(const Trace &other) {
     if (this != &other) {
       mmap = other.mmap;
       locks = other.locks;
       events = other.events;
       prev = other.prev;
+      zobrist = other.zobrist;
+      waits = other.waits;
+      stale = other.stale;
+      sleep = other.sleep;
+      redo = other.redo;
     }
     return *this;
   };
@@ -85,23 +236,91 @@ public:
       mmap = std::move(other.mmap);
       locks = std::move(other.locks);
       events = std::move(other.events);
-      prev = other.prev;
+      prev = std::move(other.prev);
+      zobrist = other.zobrist;
+      waits = std::move(other.waits);
+      stale = other.stale;
+      sleep = other.sleep;
+      redo = other.redo;
     }
     return *this;
   }
 
-  /* Returns ptr to next reordering to be explored */
+  /* Returns ptr to next reordering to be explored. Its predecessor is only
+   * recorded by setPrev. */
   std::shared_ptr<Trace> appendEvent(CommonArg &arg, std::vector<eid_t> &iset,
-                                     EventId id, EventId e1, EventId e2);
+                                     const StateEncoder &encoder,
+                                     const SearchWeights &weights, EventId id,
+                                     EventId e1, EventId e2);
 
-  /* Returns list of events executable in Trace */
+  /* Returns list of events executable in Trace, other than e1 and e2 */
   std::vector<EventId> getExecutableEvents(CommonArg &arg,
                                            std::vector<eid_t> &iset, EventId e1,
                                            EventId e2);
 
+  /* Sleep set reduction: drops the events of executables, the result of
+   * getExecutableEvents, whose threads sleep in this node or are not to be
+   * redone. Returns the sleep set of the successor reached by each remaining
+   * event, which holds the sleeping events and the events before it that
+   * commute with it. */
+  std::vector<uint64_t> reduce(CommonArg &arg, std::vector<eid_t> &iset,
+                               std::vector<EventId> &executables, EventId e1,
+                               EventId e2);
+
+  uint64_t getSleep() const { return sleep; }
+  void setSleep(uint64_t s) { sleep = s; }
+  void setRedo(uint64_t r) { redo = r; }
+
   /* Squash Reads to reduce redundant interleavings */
-  void advanceReads(CommonArg &arg, std::vector<eid_t> &iset, EventId e1,
-                    EventId e2);
+  void advanceReads(CommonArg &arg, std::vector<eid_t> &iset,
+                    const StateEncoder &encoder, EventId e1, EventId e2);
+
+  uint32_t getPriority() const { return priority; }
+  uint32_t getDepth() const { return depth; }
+
+  /* Returns a bound on the depth of the reorderings of include set iset, i.e.
+   * the number of events it includes */
+  static uint32_t maxDepth(const std::vector<eid_t> &iset) {
+    uint64_t total = 0;
+    for (eid_t last : iset)
+      if (last != UNUSED)
+        total += static_cast<uint64_t>(last) + 1;
+    return static_cast<uint32_t>(std::min<uint64_t>(total, UINT32_MAX));
+  }
+
+  /* Returns a bound on the priorities computePriority gives reorderings of
+   * (e1, e2). No event is further from e1 or e2 than at the start. */
+  static uint32_t maxPriority(EventId e1, EventId e2,
+                              const SearchWeights &weights) {
+    uint64_t bound =
+        (static_cast<uint64_t>(e1.getEid()) + e2.getEid()) * weights.distance +
+        2 * static_cast<uint64_t>(weights.threshold);
+    return static_cast<uint32_t>(std::min<uint64_t>(bound, UINT32_MAX));
+  }
+
+  /* Returns word 0 or 1 of the Zobrist hash of the state, which is kept up to
+   * date as events are appended. Reorderings with the same encoding have the
+   * same hash. */
+  uint64_t getHash(size_t word) const { return zobrist[word]; }
+
+  /* Records the reordering this one was appended to, for getWitness */
+  void setPrev(std::shared_ptr<Trace> p) { prev = std::move(p); }
+
+  size_t getNumThreads() const { return events.size(); }
+
+  /* Calls f(var, value) for every variable written, in order of var */
+  template <typename F> void forEachValue(F f) const { mmap.forEach(f); }
+
+  /* Returns an estimate of the bytes held by this node and not shared with
+   * other nodes, including the shared pointer referring to it */
+  size_t memoryUsage() const {
+    return sizeof(Trace) + 2 * sizeof(void *) + events.ownedBytes() +
+           waits.ownedBytes() + mmap.ownedBytes() + locks.ownedBytes();
+  }
+
+  /* Returns the eid of the next event of thread tid, or one of UNUSED,
+   * TO_BE_FORKED and COMPLETED */
+  eid_t getNextEvent(tid_t tid) const { return events[tid]; }
 
   /* Returns the sequence of events executed in the current trace */
   std::vector<Event> getWitness(std::vector<std::vector<Event>> &event);
@@ -125,68 +344,4 @@ public:
 
     return true;
   }
-
-  friend struct std::hash<Trace>;
-  friend struct TracePtrCmp;
-};
-
-namespace std {
-template <> struct hash<Trace> {
-  std::size_t operator()(const Trace &trace) const {
-    size_t prime = 31;
-    size_t hash = 1;
-
-    size_t mmapHash = trace.mmap.size();
-    for (const auto &[key, value] : trace.mmap) {
-      mmapHash ^= std::hash<uint32_t>()(key) ^
-                  std::hash<uint32_t>()(value) + 0x9e3779b9 + (mmapHash << 6) +
-                      (mmapHash >> 2); // Combine hashes
-    }
-
-    size_t eventHash = trace.events.size();
-    for (tid_t i = 0; i < trace.events.size(); ++i) {
-      auto idx = trace.events[i];
-      eventHash ^= std::hash<EventId>()({i, idx}) + 0x9e3779b9 +
-                   (eventHash << 6) + (eventHash >> 2); // Combine hashes
-    }
-
-    hash = prime * hash + mmapHash;
-    hash = prime * hash + eventHash;
-
-    return hash;
-  }
-};
-
-template <> struct std::hash<std::shared_ptr<Trace>> {
-  size_t operator()(const std::shared_ptr<Trace> &ptr) const {
-    return std::hash<Trace>()(*ptr);
-  }
-};
-
-template <> struct equal_to<std::shared_ptr<Trace>> {
-  bool operator()(const std::shared_ptr<Trace> &lhs,
-                  const std::shared_ptr<Trace> &rhs) const {
-    return *lhs == *rhs; // Compare the values inside unique_ptr
-  }
-};
-// template <> struct std::hash<std::unique_ptr<Trace>> {
-//   size_t operator()(const std::unique_ptr<Trace> &ptr) const {
-//     return std::hash<Trace>()(*ptr);
-//   }
-// };
-
-// template <> struct equal_to<std::unique_ptr<Trace>> {
-//   bool operator()(const std::unique_ptr<Trace> &lhs,
-//                   const std::unique_ptr<Trace> &rhs) const {
-//     return *lhs == *rhs; // Compare the values inside unique_ptr
-//   }
-// };
-} // namespace std
-
-struct TracePtrCmp {
-  bool operator()(const std::shared_ptr<Trace> &ptr1,
-                  const std::shared_ptr<Trace> &ptr2) {
-    // Min-heap: higher priority comes first
-    return ptr1->priority > ptr2->priority;
-  }
 };
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "errors.hpp"
+#include "parallel.hpp"
+#include "serialize.hpp"
+#include "tracefile.hpp"
+
+/* Direct-mapped table of the last value seen per var, used to predict values.
+ * Encoder and decoder update it identically so no table is stored. */
+class ValuePredictor {
+private:
+  static const size_t SIZE = 4096;
+  std::array<std::pair<vid_t, uint32_t>, SIZE> slots;
+
+public:
+  ValuePredictor() { slots.fill({static_cast<vid_t>(-1), 0}); }
+
+  uint32_t predict(vid_t var) const {
+    auto &slot = slots[var & (SIZE - 1)];
+    return slot.first == var ? slot.second : 0;
+  }
+
+  void update(vid_t var, uint32_t value) {
+    slots[var & (SIZE - 1)] = {var, value};
+  }
+};
+
+static void encodeBlock(BinaryWriter &out, const Event *events, size_t n) {
+  std::vector<uint8_t> types((n + 1) / 2, 0);
+  for (size_t k = 0; k < n; ++k)
+    types[k / 2] |= events[k].getEventType() << (k % 2 * 4);
+  out.putBytes(types.data(), types.size());
+
+  uint32_t prevNum = 0;
+  for (size_t k = 0; k < n; ++k) {
+    out.putVarint(events[k].getEventNum() - prevNum);
+    prevNum = events[k].getEventNum();
+  }
+
+  vid_t prevVar = 0;
+  for (size_t k = 0; k < n; ++k) {
+    out.putVarint(zigzag(static_cast<int32_t>(events[k].getVarId() - prevVar)));
+    prevVar = events[k].getVarId();
+  }
+
+  ValuePredictor values;
+  for (size_t k = 0; k < n; ++k) {
+    vid_t var = events[k].getVarId();
+    uint32_t value = events[k].getVarValue();
+    out.putVarint(zigzag(static_cast<int32_t>(value - values.predict(var))));
+    values.update(var, value);
+  }
+}
+
+/* Fewest bytes a block of n events can take: packed types and one byte for
+ * each of the three varints of an event */
+static size_t minBlockBytes(size_t n) { return (n + 1) / 2 + 3 * n; }
+
+/* Decodes a block of n events of thread tid into out. seen marks the event
+ * numbers decoded so far, of which there are numEvents, so that a number out
+ * of range or used twice is rejected. */
+static void decodeBlock(BinaryReader in, tid_t tid, size_t n, Event *out,
+                        std::atomic<uint64_t> *seen, uint64_t numEvents) {
+  const uint8_t *types = in.getBytes((n + 1) / 2);
+
+  std::vector<uint32_t> nums(n);
+  uint64_t num = 0;
+  for (size_t k = 0; k < n; ++k) {
+    num += in.getVarint();
+    if (num >= numEvents)
+      throw FormatError{"event number out of range"};
+
+    uint64_t bit = uint64_t{1} << (num % 64);
+    if (seen[num / 64].fetch_or(bit, std::memory_order_relaxed) & bit)
+      throw FormatError{"event number " + std::to_string(num) +
+                        " appears twice"};
+    nums[k] = static_cast<uint32_t>(num);
+  }
+
+  std::vector<vid_t> vars(n);
+  vid_t var = 0;
+  for (size_t k = 0; k < n; ++k) {
+    var += unzigzag(static_cast<uint32_t>(in.getVarint()));
+    vars[k] = var;
+  }
+
+  ValuePredictor values;
+  for (size_t k = 0; k < n; ++k) {
+    uint32_t value = values.predict(vars[k]) +
+                     unzigzag(static_cast<uint32_t>(in.getVarint()));
+    values.update(vars[k], value);
+
+    uint8_t type = (types[k / 2] >> (k % 2 * 4)) & 0xF;
+    if (type > EventType::Join)
+      throw FormatError{"unknown event type " + std::to_string(type)};
+    out[k] = Event{Event::createRawEvent(static_cast<EventType>(type), tid,
+                                         vars[k], value),
+                   nums[k]};
+  }
+}
+
+bool isCompressedTrace(const void *data, size_t size) {
+  return size >= sizeof(TraceHeader) &&
+         std::memcmp(data, TRACE_MAGIC, sizeof(TRACE_MAGIC)) == 0;
+}
+
+ParseResult readCompressedTrace(const void *data, size_t size,
+                                size_t num_threads) {
+  BinaryReader in{data, size};
+  TraceHeader header = in.get<TraceHeader>();
+
+  if (std::memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0)
+    throw FormatError{"not a compressed trace"};
+  if (header.version != TRACE_VERSION)
+    throw FormatError{"unsupported compressed trace version " +
+                      std::to_string(header.version)};
+  // Every event takes at least 3 bytes of block data
+  if (header.num_threads > 256 || header.num_events > size / 3 ||
+      header.num_blocks > size / sizeof(BlockEntry))
+    throw FormatError{"compressed trace header out of range"};
+
+  ParseResult pr;
+  pr.events.resize(header.num_threads);
+  uint64_t total = 0;
+  for (tid_t tid = 0; tid < header.num_threads; ++tid) {
+    ThreadEntry thread = in.get<ThreadEntry>();
+    if (thread.num_events > header.num_events - total)
+      throw FormatError{"thread event counts exceed trace"};
+    total += thread.num_events;
+    pr.events[tid].resize(thread.num_events);
+    pr.thread_to_tid_map.emplace(thread.thread_id, tid);
+  }
+
+  if (total != header.num_events)
+    throw FormatError{"thread event counts do not add up to trace"};
+
+  in.seek(header.index_offset);
+  std::vector<BlockEntry> index(header.num_blocks);
+  for (auto &block : index) {
+    block = in.get<BlockEntry>();
+    if (block.tid >= header.num_threads ||
+        block.first_eid > pr.events[block.tid].size() ||
+        block.num_events > pr.events[block.tid].size() - block.first_eid ||
+        block.offset > size || block.length > size - block.offset ||
+        block.length < minBlockBytes(block.num_events))
+      throw FormatError{"block index entry out of range"};
+  }
+
+  // Blocks must tile each thread, without gaps or overlaps
+  std::vector<const BlockEntry *> sorted;
+  for (const BlockEntry &block : index)
+    sorted.push_back(&block);
+  std::sort(sorted.begin(), sorted.end(),
+            [](const BlockEntry *a, const BlockEntry *b) {
+              return a->tid != b->tid ? a->tid < b->tid
+                                      : a->first_eid < b->first_eid;
+            });
+
+  std::vector<uint64_t> covered(header.num_threads, 0);
+  for (const BlockEntry *block : sorted) {
+    if (block->first_eid != covered[block->tid])
+      throw FormatError{"blocks overlap or leave a gap in thread " +
+                        std::to_string(block->tid)};
+    covered[block->tid] += block->num_events;
+  }
+
+  for (tid_t tid = 0; tid < header.num_threads; ++tid)
+    if (covered[tid] != pr.events[tid].size())
+      throw FormatError{"blocks do not cover thread " + std::to_string(tid)};
+
+  std::vector<std::atomic<uint64_t>> seen((header.num_events + 63) / 64);
+  size_t workers = std::clamp<size_t>(num_threads, 1, index.size());
+  runParallel(index.empty() ? 0 : workers, [&](size_t w) {
+    for (size_t b = w; b < index.size(); b += workers) {
+      const BlockEntry &block = index[b];
+      BinaryReader blockIn{static_cast<const uint8_t *>(data) + block.offset,
+                           block.length};
+      decodeBlock(blockIn, block.tid, block.num_events,
+                  pr.events[block.tid].data() + block.first_eid, seen.data(),
+                  header.num_events);
+    }
+  });
+
+  // Blocks are decoded independently, so only the events at their seams are
+  // left to check for program order
+  for (const BlockEntry *block : sorted) {
+    const std::vector<Event> &thread = pr.events[block->tid];
+    if (block->first_eid > 0 && block->num_events > 0 &&
+        thread[block->first_eid].getEventNum() <=
+            thread[block->first_eid - 1].getEventNum())
+      throw FormatError{"blocks of thread " + std::to_string(block->tid) +
+                        " are out of order"};
+  }
+
+  return pr;
+}
+
+/* Returns the original thread id of each tid_t */
+static std::vector<uint32_t> originalThreadIds(const ParseResult &pr) {
+  std::vector<uint32_t> ids(pr.events.size());
+  for (tid_t tid = 0; tid < ids.size(); ++tid)
+    ids[tid] = tid;
+
+  for (auto [thread, tid] : pr.thread_to_tid_map)
+    if (tid < ids.size())
+      ids[tid] = thread;
+
+  return ids;
+}
+
+void writeCompressedTrace(const ParseResult &pr, const std::string &filename,
+                          uint32_t block_events) {
+  std::vector<uint32_t> threadIds = originalThreadIds(pr);
+  BinaryWriter out;
+
+  TraceHeader header{};
+  std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+  header.version = TRACE_VERSION;
+  header.num_threads = pr.events.size();
+  header.block_events = block_events;
+  for (auto &thread : pr.events)
+    header.num_events += thread.size();
+  out.put(header);
+
+  for (tid_t tid = 0; tid < pr.events.size(); ++tid)
+    out.put(ThreadEntry{threadIds[tid], 0, pr.events[tid].size()});
+
+  std::vector<BlockEntry> index;
+  for (tid_t tid = 0; tid < pr.events.size(); ++tid) {
+    const std::vector<Event> &thread = pr.events[tid];
+    for (size_t first = 0; first < thread.size(); first += block_events) {
+      size_t n = std::min<size_t>(block_events, thread.size() - first);
+      size_t offset = out.size();
+      encodeBlock(out, thread.data() + first, n);
+      index.push_back(BlockEntry{tid, static_cast<uint32_t>(n), first, offset,
+                                 out.size() - offset});
+    }
+  }
+
+  header.num_blocks = index.size();
+  header.index_offset = out.size();
+  for (auto &block : index)
+    out.put(block);
+  out.patch(0, header);
+
+  writeBinaryFile(filename, out.data().data(), out.size());
+}
+
+void writeRawTrace(const ParseResult &pr, const std::string &filename) {
+  std::vector<uint32_t> threadIds = originalThreadIds(pr);
+
+  size_t totalSize = 0;
+  for (auto &thread : pr.events)
+    totalSize += thread.size();
+
+  std::vector<uint64_t> raw(totalSize);
+  for (tid_t tid = 0; tid < pr.events.size(); ++tid)
+    for (const Event &e : pr.events[tid]) {
+      if (e.getEventNum() >= totalSize)
+        throw FormatError{"event number out of range"};
+      raw[e.getEventNum()] = Event::createRawEvent(
+          e.getEventType(), threadIds[tid], e.getVarId(), e.getVarValue());
+    }
+
+  writeBinaryFile(filename, raw.data(), raw.size() * sizeof(uint64_t));
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "parser.hpp"
+
+/*
+** Compressed, indexed trace format.
+**
+** Layout:
+**   TraceHeader
+**   ThreadEntry[num_threads]   original thread id and event count per tid_t
+**   blocks                     up to block_events events of a single thread
+**   BlockEntry[num_blocks]     block index, at header.index_offset
+**
+** Each block stores its events column by column: event types packed two per
+** byte, then varint deltas of event numbers, zigzag varint deltas of var ids,
+** and zigzag varint deltas of values against the last value seen for the same
+** var in the block. Blocks are self-contained so they can be decoded in
+** parallel and located through the index without scanning.
+*/
+
+const char TRACE_MAGIC[8] = {'E', 'R', 'D', 'T', 'R', 'A', 'C', 'E'};
+const uint32_t TRACE_VERSION = 1;
+const uint32_t DEFAULT_BLOCK_EVENTS = 1 << 16;
+
+struct TraceHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t num_threads;
+  uint64_t num_events;
+  uint32_t block_events;
+  uint32_t num_blocks;
+  uint64_t index_offset;
+};
+
+struct ThreadEntry {
+  uint32_t thread_id; // thread id in the original input trace
+  uint32_t reserved;
+  uint64_t num_events;
+};
+
+struct BlockEntry {
+  uint32_t tid;
+  uint32_t num_events;
+  uint64_t first_eid;
+  uint64_t offset; // from start of file
+  uint64_t length; // in bytes
+};
+
+/* Returns if the buffer starts with a compressed trace header */
+bool isCompressedTrace(const void *data, size_t size);
+
+/* Decodes a compressed trace, using up to num_threads threads */
+ParseResult readCompressedTrace(const void *data, size_t size,
+                                size_t num_threads = 1);
+
+/* Writes parsed events in compressed format */
+void writeCompressedTrace(const ParseResult &pr, const std::string &filename,
+                          uint32_t block_events = DEFAULT_BLOCK_EVENTS);
+
+/* Writes parsed events back in the raw 64-bit format, restoring the original
+ * thread ids */
+void writeRawTrace(const ParseResult &pr, const std::string &filename);
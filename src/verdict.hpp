@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "event.hpp"
+#include "trace.hpp"
+
+/* Verdict of a COP. UNKNOWN marks pairs whose search ran out of budget, they
+ * can still turn out to be races. */
+enum Verdict : uint8_t { PENDING, RACE, NO_RACE, UNKNOWN };
+
+/* Verdicts of all COPs, shared between prediction workers.
+ *
+ * Every state reached while searching for one COP is a correct reordering
+ * prefix, so any other COP whose two events are both next in their threads at
+ * that state is a race as well. COPs are indexed by their first event, which
+ * lets a state find the pending COPs it witnesses with one lookup per
+ * thread. */
+class VerdictBoard {
+private:
+  const std::vector<std::pair<EventId, EventId>> &cops;
+  std::unique_ptr<std::atomic<uint8_t>[]> verdicts;
+  std::atomic<size_t> unresolved; // COPs neither RACE nor NO_RACE
+
+  /* For each thread, the COPs whose first event is in that thread, by eid */
+  std::vector<std::unordered_map<eid_t, std::vector<size_t>>> by_first;
+
+public:
+  VerdictBoard(const std::vector<std::pair<EventId, EventId>> &cops_,
+               size_t numThreads)
+      : cops{cops_}, verdicts{new std::atomic<uint8_t>[cops_.size()]},
+        unresolved{cops_.size()}, by_first(numThreads) {
+    for (size_t i = 0; i < cops.size(); ++i) {
+      verdicts[i].store(PENDING, std::memory_order_relaxed);
+      by_first[cops[i].first.getTid()][cops[i].first.getEid()].push_back(i);
+    }
+  }
+
+  VerdictBoard(const VerdictBoard &) = delete;
+  VerdictBoard &operator=(const VerdictBoard &) = delete;
+
+  /* Returns the number of COPs */
+  size_t size() const { return cops.size(); }
+
+  const std::pair<EventId, EventId> &getCOP(size_t cop) const {
+    return cops[cop];
+  }
+
+  Verdict getVerdict(size_t cop) const {
+    return static_cast<Verdict>(verdicts[cop].load(std::memory_order_acquire));
+  }
+
+  bool isDecided(size_t cop) const { return getVerdict(cop) != PENDING; }
+
+  /* Returns if cop is known to be a race or not */
+  bool isResolved(size_t cop) const {
+    Verdict verdict = getVerdict(cop);
+    return verdict == RACE || verdict == NO_RACE;
+  }
+
+  /* Records the verdict of a pending cop, or of an UNKNOWN one found to be a
+   * race. Returns false if cop was already decided. */
+  bool decide(size_t cop, Verdict verdict) {
+    uint8_t current = verdicts[cop].load(std::memory_order_acquire);
+    while (current == PENDING || (current == UNKNOWN && verdict == RACE)) {
+      if (verdicts[cop].compare_exchange_weak(current, verdict,
+                                              std::memory_order_acq_rel)) {
+        if (verdict != UNKNOWN)
+          unresolved.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  /* Makes an UNKNOWN cop pending again, e.g. to retry it with a larger
+   * budget. Returns false if cop has been resolved in the meantime. */
+  bool reopen(size_t cop) {
+    uint8_t expected = UNKNOWN;
+    return verdicts[cop].compare_exchange_strong(expected, PENDING,
+                                                 std::memory_order_acq_rel);
+  }
+
+  /* Returns the index of COP (e1, e2), or the number of COPs if absent */
+  size_t indexOf(EventId e1, EventId e2) const {
+    auto it = by_first[e1.getTid()].find(e1.getEid());
+    if (it != by_first[e1.getTid()].end())
+      for (size_t cop : it->second)
+        if (cops[cop].second == e2)
+          return cop;
+
+    return cops.size();
+  }
+
+  /* Marks every pending COP whose events are both next in state as a race,
+   * calling onRace(cop) for each COP decided by this call */
+  template <typename F> void harvest(const Trace &state, F onRace) {
+    if (unresolved.load(std::memory_order_relaxed) == 0)
+      return;
+
+    for (tid_t tid = 0; tid < by_first.size(); ++tid) {
+      eid_t next = state.getNextEvent(tid);
+      if (next >= COMPLETED)
+        continue;
+
+      auto it = by_first[tid].find(next);
+      if (it == by_first[tid].end())
+        continue;
+
+      for (size_t cop : it->second) {
+        const EventId &e2 = cops[cop].second;
+        if (state.getNextEvent(e2.getTid()) == e2.getEid() &&
+            !isResolved(cop) && decide(cop, RACE))
+          onRace(cop);
+      }
+    }
+  }
+
+  /* Returns the indices of all COPs with the given verdict, in COP order */
+  std::vector<size_t> getCOPs(Verdict verdict) const {
+    std::vector<size_t> result;
+    for (size_t i = 0; i < cops.size(); ++i)
+      if (getVerdict(i) == verdict)
+        result.push_back(i);
+
+    return result;
+  }
+};
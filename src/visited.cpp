@@ -0,0 +1,221 @@
+#include <algorithm>
+
+#include "preprocesser.hpp"
+#include "trace.hpp"
+#include "visited.hpp"
+
+/* LEB128 encoding, 7 bits per byte */
+static inline void appendVarint(std::vector<uint8_t> &out, uint64_t value) {
+  while (value >= 0x80) {
+    out.push_back(static_cast<uint8_t>(value) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+void StateEncoder::reset(CommonArg &arg, const std::vector<eid_t> &iset) {
+  lastAccess.clear();
+  for (tid_t t = 0; t < iset.size(); ++t) {
+    // Unused threads can still be forked, and then run to completion
+    eid_t end = iset[t] == UNUSED
+                    ? arg.events[t].size()
+                    : std::min<eid_t>(iset[t] + 1, arg.events[t].size());
+
+    // Variables are ordered by first access, so those touched by the
+    // included events come first
+    const std::vector<vid_t> &vars = arg.thread_accesses.vars[t];
+    const std::vector<uint32_t> &offsets = arg.thread_accesses.offsets[t];
+    const std::vector<eid_t> &eids = arg.thread_accesses.eids[t];
+    for (size_t k = 0; k < vars.size(); ++k) {
+      auto first = eids.begin() + offsets[k];
+      if (*first >= end)
+        break;
+
+      auto last = std::lower_bound(first, eids.begin() + offsets[k + 1], end);
+      lastAccess[vars[k]].push_back({t, *(last - 1)});
+    }
+  }
+}
+
+bool StateEncoder::isLive(const Trace &t, vid_t var) const {
+  auto last = lastAccess.find(var);
+  if (last == lastAccess.end())
+    return true;
+
+  for (const EventId &access : last->second) {
+    eid_t next = t.getNextEvent(access.getTid());
+    if (next == UNUSED || next == TO_BE_FORKED ||
+        (next < COMPLETED && next <= access.getEid()))
+      return true;
+  }
+
+  return false;
+}
+
+void StateEncoder::encode(const Trace &t, std::vector<uint8_t> &out) const {
+  out.clear();
+
+  // Sentinels wrap around to 0, 1 and 2
+  for (tid_t i = 0; i < t.getNumThreads(); ++i)
+    appendVarint(out, t.getNextEvent(i) - COMPLETED);
+
+  vid_t prev = 0;
+  t.forEachValue([&](vid_t var, uint32_t value) {
+    if (!isLive(t, var))
+      return;
+
+    appendVarint(out, var - prev);
+    appendVarint(out, value);
+    prev = var;
+  });
+}
+
+bool VisitedTable::matches(uint64_t offset,
+                           std::span<const uint8_t> key) const {
+  uint64_t length = 0;
+  for (uint32_t shift = 0;; shift += 7) {
+    uint8_t byte = keys[offset++];
+    length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if (byte < 0x80)
+      break;
+  }
+
+  return length == key.size() &&
+         std::equal(key.begin(), key.end(), keys.begin() + offset);
+}
+
+void VisitedTable::allocate(size_t numSlots) {
+  slots.assign(numSlots * stride, 0);
+  tags.assign(numSlots, 0);
+  generation = 1;
+}
+
+void VisitedTable::grow() {
+  std::vector<uint64_t> oldSlots = std::move(slots);
+  std::vector<uint32_t> oldTags = std::move(tags);
+  uint32_t oldGeneration = generation;
+  allocate(std::max<size_t>(oldTags.size() * 2, MIN_SLOTS));
+
+  size_t mask = tags.size() - 1;
+  for (size_t i = 0; i < oldTags.size(); ++i) {
+    if (oldTags[i] != oldGeneration)
+      continue;
+
+    size_t j = oldSlots[i * stride] & mask;
+    while (isFull(j))
+      j = (j + 1) & mask;
+    std::copy(oldSlots.begin() + i * stride,
+              oldSlots.begin() + (i + 1) * stride, slots.begin() + j * stride);
+    tags[j] = generation;
+  }
+}
+
+void VisitedTable::reset(VisitedMode mode_, bool sleepSets_) {
+  size_t newStride = strideOf(mode_, sleepSets_);
+  mode = mode_;
+  sleepSets = sleepSets_;
+  count = 0;
+
+  // A table grown by a large search is released, with its encodings, rather
+  // than held on to for the searches that follow
+  if (newStride != stride || tags.empty() || tags.size() > MAX_KEPT_SLOTS) {
+    stride = newStride;
+    allocate(MIN_SLOTS);
+    std::vector<uint8_t>{}.swap(keys);
+    return;
+  }
+
+  keys.clear();
+  if (++generation == 0) {
+    std::fill(tags.begin(), tags.end(), 0);
+    generation = 1;
+  }
+}
+
+bool VisitedTable::insert(std::span<const uint8_t> key, uint64_t hash,
+                          uint64_t second, uint64_t sleep, uint64_t &redo) {
+  redo = 0;
+
+  // Keep at most half of the slots full
+  if (2 * (count + 1) > tags.size())
+    grow();
+
+  size_t mask = tags.size() - 1;
+  size_t j = hash & mask;
+  for (; isFull(j); j = (j + 1) & mask) {
+    uint64_t *slot = &slots[j * stride];
+    if (slot[0] != hash)
+      continue;
+
+    bool same = false;
+    switch (mode) {
+    case VisitedMode::EXACT:
+      same = matches(slot[1], key);
+      break;
+    case VisitedMode::FINGERPRINT_64:
+      same = true;
+      break;
+    case VisitedMode::FINGERPRINT_128:
+      same = slot[1] == second;
+      break;
+    }
+
+    if (!same)
+      continue;
+
+    // Events asleep in every expansion so far, but not now, still have to
+    // be explored from the state
+    if (!sleepSets || (slot[stride - 1] & ~sleep) == 0)
+      return false;
+
+    redo = slot[stride - 1] & ~sleep;
+    slot[stride - 1] &= sleep;
+    return true;
+  }
+
+  uint64_t *slot = &slots[j * stride];
+  tags[j] = generation;
+  slot[0] = hash;
+  if (mode == VisitedMode::EXACT) {
+    slot[1] = keys.size();
+    appendVarint(keys, key.size());
+    keys.insert(keys.end(), key.begin(), key.end());
+  } else if (mode == VisitedMode::FINGERPRINT_128) {
+    slot[1] = second;
+  }
+
+  if (sleepSets)
+    slot[stride - 1] = sleep;
+
+  ++count;
+  return true;
+}
+
+void VisitedSet::reset(VisitedMode mode_, size_t numShards, bool sleepSets) {
+  mode = mode_;
+  if (shards.size() != std::max<size_t>(numShards, 1))
+    shards = std::vector<Shard>(std::max<size_t>(numShards, 1));
+
+  for (Shard &shard : shards)
+    shard.table.reset(mode, sleepSets);
+}
+
+bool VisitedSet::insert(Trace &t, const StateEncoder &encoder,
+                        std::vector<uint8_t> &key, size_t &bytes) {
+  if (mode == VisitedMode::EXACT)
+    encoder.encode(t, key);
+  else
+    key.clear();
+
+  uint64_t hash = t.getHash(0);
+  Shard &shard = shards[(hash >> 48) % shards.size()];
+
+  std::lock_guard<std::mutex> lock{shard.mutex};
+  uint64_t redo;
+  if (!shard.table.insert(key, hash, t.getHash(1), t.getSleep(), redo))
+    return false;
+
+  t.setRedo(redo);
+  bytes = redo == 0 ? shard.table.entryBytes(key) : 0;
+  return true;
+}
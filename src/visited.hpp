@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+#include "event.hpp"
+
+struct CommonArg;
+class Trace;
+
+/* How the states visited by a search are stored */
+enum class VisitedMode : uint8_t {
+  EXACT,           // canonical encoding of each state
+  FINGERPRINT_64,  // 64 bit hash of each state, distinct states may collide
+  FINGERPRINT_128, // 128 bit hash of each state
+};
+
+/* Zobrist key of part of a state taking value, in the given word of a
+ * fingerprint. Parts are numbered 2 * tid for the position of a thread and
+ * 2 * var + 1 for the value of a variable. Keys are computed by mixing rather
+ * than looked up in a table, and differ for every (part, value, word). */
+inline uint64_t zobristKey(uint64_t part, uint64_t value, size_t word) {
+  uint64_t h = ((part << 32) | (value & 0xffffffff)) ^
+               (word * 0x9e3779b97f4a7c15);
+
+  // splitmix64 finalizer
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111eb;
+  h ^= h >> 31;
+  return h;
+}
+
+/* Packs a reordering of a COP into a canonical byte string, so that two
+ * reorderings get the same encoding iff they can be extended in the same ways.
+ *
+ * The encoding holds the next event of each thread and the value of every
+ * variable that an event still to be executed accesses, as varints. Held
+ * locks are not encoded as they follow from the thread positions.
+ *
+ * Trace keeps a Zobrist hash of the same parts of its state, see
+ * Trace::getHash. */
+class StateEncoder {
+private:
+  /* For each variable, the last access of each thread accessing it among the
+   * included events */
+  std::unordered_map<vid_t, std::vector<EventId>> lastAccess;
+
+public:
+  StateEncoder() = default;
+  StateEncoder(CommonArg &arg, const std::vector<eid_t> &iset) {
+    reset(arg, iset);
+  }
+
+  /* Rebuilds the encoder for the COP with include set iset */
+  void reset(CommonArg &arg, const std::vector<eid_t> &iset);
+
+  /* Returns if an event still to be executed in t accesses var */
+  bool isLive(const Trace &t, vid_t var) const;
+
+  /* Replaces out with the encoding of t */
+  void encode(const Trace &t, std::vector<uint8_t> &out) const;
+};
+
+/* Open addressing hash table of visited states. Each slot holds the hash of a
+ * state, and either the offset of its encoding in a byte arena (EXACT),
+ * nothing more (FINGERPRINT_64) or a second, independent hash
+ * (FINGERPRINT_128). With sleep sets, the last word of a slot holds the sleep
+ * set the state was last expanded with.
+ *
+ * A slot is only full if its tag is the current generation, so that the
+ * table is emptied for the next search by bumping the generation. */
+class VisitedTable {
+private:
+  VisitedMode mode;
+  bool sleepSets;
+  size_t stride; // words per slot
+  std::vector<uint64_t> slots;
+  std::vector<uint32_t> tags; // generation each slot was filled in
+  uint32_t generation = 1;
+  std::vector<uint8_t> keys; // length prefixed encodings, EXACT only
+  size_t count = 0;
+
+  static size_t strideOf(VisitedMode mode, bool sleepSets) {
+    return (mode == VisitedMode::FINGERPRINT_64 ? 1u : 2u) +
+           (sleepSets ? 1u : 0u);
+  }
+
+  /* Slots of an empty table, and most slots kept from one search to the
+   * next, so that a search visiting few states stays cheap after a large
+   * one */
+  static constexpr size_t MIN_SLOTS = 64;
+  static constexpr size_t MAX_KEPT_SLOTS = 1 << 12;
+
+  bool isFull(size_t slot) const { return tags[slot] == generation; }
+
+  /* Replaces the slots with numSlots empty ones */
+  void allocate(size_t numSlots);
+
+  /* Returns if the encoding stored at offset equals key */
+  bool matches(uint64_t offset, std::span<const uint8_t> key) const;
+
+  void grow();
+
+public:
+  explicit VisitedTable(VisitedMode mode_ = VisitedMode::EXACT,
+                        bool sleepSets_ = false)
+      : mode{mode_}, sleepSets{sleepSets_},
+        stride{strideOf(mode_, sleepSets_)} {}
+
+  /* Empties the table for a new search. Up to MAX_KEPT_SLOTS slots are kept,
+   * a larger table starts over from MIN_SLOTS and grows as states are
+   * added. */
+  void reset(VisitedMode mode_, bool sleepSets_);
+
+  /* Adds the state with the given hashes, encoded by key, returns false if it
+   * was already visited. key is only used by EXACT tables.
+   *
+   * With sleep sets, a state visited before is expanded again if it was
+   * stored with events asleep that are awake in sleep. redo is set to these
+   * events, which are all that is explored again, or to 0 for a new state. */
+  bool insert(std::span<const uint8_t> key, uint64_t hash, uint64_t second,
+              uint64_t sleep, uint64_t &redo);
+
+  size_t size() const { return count; }
+
+  /* Returns the bytes held by the table */
+  size_t memoryUsage() const {
+    return slots.capacity() * sizeof(uint64_t) +
+           tags.capacity() * sizeof(uint32_t) + keys.capacity();
+  }
+
+  /* Returns an estimate of the bytes an entry for key takes */
+  size_t entryBytes(std::span<const uint8_t> key) const {
+    size_t bytes = 2 * stride * sizeof(uint64_t); // slots are half full
+    if (mode == VisitedMode::EXACT)
+      bytes += key.size() + 2;
+    return bytes;
+  }
+};
+
+/* Visited set of a search, split into shards with a lock each so that the
+ * threads of a parallel search can share it */
+class VisitedSet {
+private:
+  struct Shard {
+    std::mutex mutex;
+    VisitedTable table;
+  };
+
+  VisitedMode mode;
+  std::vector<Shard> shards;
+
+public:
+  VisitedSet() : VisitedSet{VisitedMode::EXACT, 1} {}
+  VisitedSet(VisitedMode mode_, size_t numShards, bool sleepSets = false)
+      : mode{mode_}, shards(std::max<size_t>(numShards, 1)) {
+    for (Shard &shard : shards)
+      shard.table = VisitedTable{mode, sleepSets};
+  }
+
+  VisitedSet(const VisitedSet &) = delete;
+  VisitedSet &operator=(const VisitedSet &) = delete;
+
+  /* Empties the set for a new search, keeping the memory of its shards
+   * unless they grew large. Not thread safe. */
+  void reset(VisitedMode mode_, size_t numShards, bool sleepSets);
+
+  /* Adds t, returns if it is to be expanded and sets the events it redoes,
+   * see VisitedTable::insert. bytes is set to the bytes a new entry takes, 0
+   * if there is none. key is scratch space for the encoding of t. */
+  bool insert(Trace &t, const StateEncoder &encoder, std::vector<uint8_t> &key,
+              size_t &bytes);
+
+  size_t size() {
+    size_t total = 0;
+    for (Shard &shard : shards) {
+      std::lock_guard<std::mutex> lock{shard.mutex};
+      total += shard.table.size();
+    }
+    return total;
+  }
+};
@@ -0,0 +1,52 @@
+#include "parser.hpp"
+#include "tracefile.hpp"
+#include <iostream>
+#include <string>
+#include <thread>
+
+/*
+** Converts traces between the raw 64-bit format and the compressed format.
+** The input format is detected automatically.
+*/
+
+auto main(int argc, char *argv[]) -> int {
+  std::string input;
+  std::string output;
+  bool raw = false;
+  uint32_t block_events = DEFAULT_BLOCK_EVENTS;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string opt{argv[i]};
+    if (opt == "-r" || opt == "--raw") {
+      raw = true;
+    } else if ((opt == "-b" || opt == "--blockEvents") && i + 1 < argc) {
+      block_events = static_cast<uint32_t>(std::stoul(argv[++i]));
+    } else if (input.empty()) {
+      input = opt;
+    } else if (output.empty()) {
+      output = opt;
+    } else {
+      std::cerr << "unrecognized command-line option " << opt << std::endl;
+    }
+  }
+
+  if (input.empty() || output.empty() || block_events == 0) {
+    std::cout << "Usage: <input_file> <output_file> [-r] [-b <BLOCK_EVENTS>]"
+              << std::endl;
+    return 0;
+  }
+
+  try {
+    ParseResult pr = parse(input, std::thread::hardware_concurrency());
+
+    if (raw)
+      writeRawTrace(pr, output);
+    else
+      writeCompressedTrace(pr, output, block_events);
+  } catch (const std::exception &e) {
+    std::cout << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}